@@ -0,0 +1,64 @@
+#pragma once
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include "timer.h"
+
+/* CoDel-style admission control of a work queue. the workers report how long every
+ * request waited in the queue; once the waits have stayed above TARGET_MS for a whole
+ * INTERVAL_MS the queue is a standing one, and the producer should refuse new requests
+ * until a request gets through below the target again, or the queue runs empty */
+class Codel
+{
+public:
+    static const time_t TARGET_MS = 20;
+    static const time_t INTERVAL_MS = 100;
+
+    Codel(): m_first_above(0), m_shedding(false) {}
+
+    // called by the workers for every dequeued request
+    void on_dequeue(time_t sojourn, time_t now)
+    {
+        if(sojourn < TARGET_MS)
+        {
+            on_empty();
+        }
+        else if(m_first_above.load(std::memory_order_relaxed) == 0)
+        {
+            m_first_above.store(now + INTERVAL_MS, std::memory_order_relaxed);
+        }
+        else if(now >= m_first_above.load(std::memory_order_relaxed))
+        {
+            set_shedding(true);
+        }
+    }
+
+    // called by the workers when they find the queue empty, or a request below target
+    void on_empty()
+    {
+        // don't dirty the shared cache line when nothing changes
+        if(m_first_above.load(std::memory_order_relaxed) != 0)
+        {
+            m_first_above.store(0, std::memory_order_relaxed);
+        }
+        set_shedding(false);
+    }
+
+    bool shedding() const {return m_shedding.load(std::memory_order_relaxed);}
+
+private:
+    void set_shedding(bool value)
+    {
+        if(m_shedding.load(std::memory_order_relaxed) != value)
+        {
+            m_shedding.store(value, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::atomic<time_t> m_first_above; // when the waits will have been above target for an interval
+    std::atomic<bool> m_shedding;
+};
+
+#endif
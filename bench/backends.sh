@@ -0,0 +1,19 @@
+#!/bin/sh
+# the epoll and the io_uring event loops under the same keep-alive load.
+# run from the top of the tree after make server server_uring bench, mysql up as for ./server
+# usage: sh bench/backends.sh [path] [server args]
+PATH_=${1:-/index.html}
+[ $# -gt 0 ] && shift
+for server in ./server ./server_uring
+do
+    $server "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    for conns in 10 100 1000
+    do
+        printf "%-15s " $server
+        bench/http_load -c $conns -t 2 -d 5 -u $PATH_
+    done
+    kill $pid
+    wait $pid
+done
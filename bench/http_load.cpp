@@ -0,0 +1,219 @@
+/* keep-alive load on a running server: every connection sends a GET, reads the whole
+ * response and sends the next one, for the given number of seconds. prints the
+ * requests per second and the latency of a request, see bench/backends.sh
+ *
+ * http_load [-a address] [-p port] [-c connections] [-t threads] [-d seconds] [-u path] */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static const char* address = "127.0.0.1";
+static int port = 8888;
+static int conn_num = 100;
+static int thread_num = 2;
+static int seconds = 5;
+static std::string request;
+
+static long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+struct Conn
+{
+    int fd;
+    long sent_at;
+    std::string in; // the response read so far
+};
+
+struct Worker
+{
+    pthread_t thread;
+    int conn_num;
+    long deadline;
+    long requests;
+    long errors;
+    std::vector<int> latencies; // us
+};
+
+static int open_conn()
+{
+    int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, address, &addr.sin_addr);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// the length of the complete response at the start of in, or 0 if it isn't all there
+static size_t response_length(const std::string& in)
+{
+    size_t end = in.find("\r\n\r\n");
+    if(end == std::string::npos)
+    {
+        return 0;
+    }
+    size_t body = 0;
+    size_t pos = in.find("Content-Length:");
+    if(pos != std::string::npos && pos < end)
+    {
+        body = strtoul(in.c_str() + pos + 15, NULL, 10);
+    }
+    size_t total = end + 4 + body;
+    return in.size() >= total ? total : 0;
+}
+
+static void* work(void* arg)
+{
+    Worker* worker = (Worker*)arg;
+    int epollfd = epoll_create(5);
+    std::vector<Conn> conns(worker->conn_num);
+    for(Conn& conn : conns)
+    {
+        conn.fd = open_conn();
+        if(conn.fd < 0)
+        {
+            worker->errors++;
+            continue;
+        }
+        epoll_event event;
+        event.data.ptr = &conn;
+        event.events = EPOLLOUT | EPOLLONESHOT;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, conn.fd, &event);
+    }
+
+    epoll_event events[256];
+    char buf[65536];
+    while(now_us() < worker->deadline)
+    {
+        int number = epoll_wait(epollfd, events, 256, 100);
+        for(int i = 0; i < number; i++)
+        {
+            Conn& conn = *(Conn*)events[i].data.ptr;
+            epoll_event event;
+            event.data.ptr = &conn;
+            event.events = EPOLLIN | EPOLLONESHOT;
+
+            // connected: the first request. the requests are small, one send takes them
+            if(events[i].events & EPOLLOUT)
+            {
+                conn.sent_at = now_us();
+                send(conn.fd, request.data(), request.size(), MSG_NOSIGNAL);
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, conn.fd, &event);
+                continue;
+            }
+
+            ssize_t n;
+            while((n = recv(conn.fd, buf, sizeof(buf), 0)) > 0)
+            {
+                conn.in.append(buf, n);
+            }
+            if(n == 0 || (n < 0 && errno != EAGAIN))
+            {
+                worker->errors++;
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, conn.fd, NULL);
+                close(conn.fd);
+                continue;
+            }
+
+            size_t length = response_length(conn.in);
+            if(length > 0)
+            {
+                long cur = now_us();
+                worker->requests++;
+                worker->latencies.push_back(cur - conn.sent_at);
+                conn.in.erase(0, length);
+                conn.sent_at = cur;
+                send(conn.fd, request.data(), request.size(), MSG_NOSIGNAL);
+            }
+            epoll_ctl(epollfd, EPOLL_CTL_MOD, conn.fd, &event);
+        }
+    }
+
+    for(Conn& conn : conns)
+    {
+        if(conn.fd >= 0)
+        {
+            close(conn.fd);
+        }
+    }
+    close(epollfd);
+    return worker;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = "/index.html";
+    int opt;
+    while((opt = getopt(argc, argv, "a:p:c:t:d:u:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a': address = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': conn_num = atoi(optarg); break;
+            case 't': thread_num = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'u': path = optarg; break;
+            default: break;
+        }
+    }
+    request = std::string("GET ") + path + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+    long start = now_us();
+    std::vector<Worker> workers(thread_num);
+    for(int i = 0; i < thread_num; i++)
+    {
+        workers[i].conn_num = conn_num / thread_num + (i < conn_num % thread_num);
+        workers[i].deadline = start + seconds * 1000000L;
+        workers[i].requests = 0;
+        workers[i].errors = 0;
+        pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+
+    long requests = 0, errors = 0;
+    std::vector<int> latencies;
+    for(Worker& worker : workers)
+    {
+        pthread_join(worker.thread, NULL);
+        requests += worker.requests;
+        errors += worker.errors;
+        latencies.insert(latencies.end(), worker.latencies.begin(), worker.latencies.end());
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    std::sort(latencies.begin(), latencies.end());
+    long sum = 0;
+    for(int latency : latencies)
+    {
+        sum += latency;
+    }
+    size_t count = latencies.size();
+    printf("%d connections, %.1f s: %.0f requests/s, latency %ld us average, %d us p50, %d us p99, %ld errors\n",
+           conn_num, elapsed, requests / elapsed, count ? sum / (long)count : 0,
+           count ? latencies[count / 2] : 0, count ? latencies[count * 99 / 100] : 0, errors);
+    return 0;
+}
@@ -0,0 +1,245 @@
+/* the request parser alone over a corpus of browser and curl requests, on one core.
+ * "scan" splits the lines and the headers as http_conn does now: find_eol and
+ * find_char of scan.h, then the perfect hash of Http_request. "bytewise" is the
+ * parser of before, given the headers known now: a byte loop for the line ends and
+ * strncasecmp against every known header in turn. both get a fresh copy of the
+ * request each time, since the parser writes '\0' over the line ends
+ *
+ * parser_bench [-i iterations over the corpus] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "../scan.h"
+#include "../http_request.h"
+
+static const char* corpus[] = {
+    // chrome
+    "GET / HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n",
+    // chrome revalidating a cached page
+    "GET /log.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Referer: http://127.0.0.1:8888/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "If-None-Match: \"5f3a2b-2e6\"\r\n"
+    "If-Modified-Since: Tue, 14 May 2024 08:12:45 GMT\r\n"
+    "\r\n",
+    // firefox
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "DNT: 1\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=9f1c2d3e4b5a6978; theme=dark\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Priority: u=1\r\n"
+    "\r\n",
+    // safari, a login form
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Origin: http://127.0.0.1:8888\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4 Safari/605.1.15\r\n"
+    "Referer: http://127.0.0.1:8888/log.html\r\n"
+    "Content-Length: 25\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n",
+    // curl
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+    // curl resuming a download
+    "GET /big.bin HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "Range: bytes=1048576-\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+    // a load generator
+    "GET / HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8888\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+};
+
+static const int CORPUS_SIZE = sizeof(corpus) / sizeof(corpus[0]);
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* the end of the next line starting at p, its "\r\n" overwritten with '\0', or nullptr.
+ * as http_conn::parse_line, with find_eol or the byte loop it replaced */
+template<bool SCAN>
+static char* next_line(char* p, char* end)
+{
+    char* eol = p;
+    if(SCAN)
+    {
+        eol = const_cast<char*>(find_eol(p, end));
+    }
+    else
+    {
+        while(eol < end && *eol != '\r' && *eol != '\n')
+        {
+            ++eol;
+        }
+    }
+    if(eol + 1 >= end || eol[0] != '\r' || eol[1] != '\n')
+    {
+        return nullptr;
+    }
+    eol[0] = eol[1] = '\0';
+    return eol + 2;
+}
+
+static const char* known_names[] = {"Connection:", "Content-Length:", "Host:", "Accept-Encoding:",
+    "If-None-Match:", "If-Modified-Since:", "Range:", "If-Range:", "Transfer-Encoding:", "Expect:", "Cookie:"};
+
+// the headers found, so the compiler keeps the work
+static volatile long found;
+
+static void parse_bytewise(char* buf, char* end)
+{
+    char* line = buf;
+    char* next = next_line<false>(line, end); // the request line
+    while(next)
+    {
+        line = next;
+        next = next_line<false>(line, end);
+        if(!next || line[0] == '\0')
+        {
+            break;
+        }
+        for(const char* name : known_names)
+        {
+            size_t len = strlen(name);
+            if(strncasecmp(line, name, len) == 0)
+            {
+                char* value = line + len;
+                value += strspn(value, " \t");
+                found += value[0];
+                break;
+            }
+        }
+    }
+}
+
+static void parse_scan(char* buf, char* end, Http_request& request)
+{
+    request.clear(buf);
+    char* line = buf;
+    char* next = next_line<true>(line, end);
+    while(next)
+    {
+        line = next;
+        next = next_line<true>(line, end);
+        if(!next || line[0] == '\0')
+        {
+            break;
+        }
+        char* line_end = next - 2;
+        char* colon = const_cast<char*>(find_char(line, line_end, ':'));
+        if(colon == line_end)
+        {
+            continue;
+        }
+        char* value = colon + 1;
+        value += strspn(value, " \t");
+        Http_request::HEADER id;
+        request.add(line, colon - line, value, line_end - value, id);
+        if(id != Http_request::UNKNOWN_HEADER)
+        {
+            found += value[0];
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int iterations = 200000;
+    int opt;
+    while((opt = getopt(argc, argv, "i:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i': iterations = atoi(optarg); break;
+            default: break;
+        }
+    }
+
+    std::vector<std::string> requests(corpus, corpus + CORPUS_SIZE);
+    size_t bytes = 0;
+    for(const std::string& request : requests)
+    {
+        bytes += request.size();
+    }
+    char buf[4096];
+    Http_request request;
+
+    printf("%d requests, %zu bytes on average, scan.h uses %s\n", CORPUS_SIZE, bytes / CORPUS_SIZE, scan_impl());
+    printf("%-10s %16s %12s\n", "parser", "requests/s", "MB/s");
+    for(int scan = 0; scan < 2; scan++)
+    {
+        long start = now_ns();
+        for(int it = 0; it < iterations; it++)
+        {
+            for(const std::string& text : requests)
+            {
+                memcpy(buf, text.data(), text.size());
+                if(scan)
+                {
+                    parse_scan(buf, buf + text.size(), request);
+                }
+                else
+                {
+                    parse_bytewise(buf, buf + text.size());
+                }
+            }
+        }
+        double elapsed = (now_ns() - start) / 1e9;
+        double parsed = (double)iterations * CORPUS_SIZE;
+        printf("%-10s %16.0f %12.0f\n", scan ? "scan" : "bytewise", parsed / elapsed,
+               (double)iterations * bytes / (1 << 20) / elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+/* the work queue of Threadpool with 1 producer and N consumers, as with a single
+ * reactor feeding the pool: Mpmc_queue with the workers parking on an Eventcount,
+ * against the Locker + std::deque + Sem it replaced. every item is a few ns of work,
+ * so the numbers are the cost of the queue itself
+ *
+ * queue_bench [-n items] [-c max consumers] [-w work iterations per item] */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "../locker.h"
+#include "../mpmc_queue.h"
+
+static const int MAX_REQUESTS = 10000;
+
+static long items = 2000000;
+static int work = 50;
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void process(long item)
+{
+    // kept from being optimized away
+    volatile long sum = item;
+    for(int i = 0; i < work; i++)
+    {
+        sum = sum + i;
+    }
+}
+
+// the pool of before the lock-free queue, less the threads
+class Locked_queue
+{
+public:
+    bool append(long item)
+    {
+        m_queuelocker.lock();
+        if((int)m_workqueue.size() >= MAX_REQUESTS)
+        {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(item);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+
+    long take()
+    {
+        m_queuestat.wait();
+        m_queuelocker.lock();
+        long item = m_workqueue.front();
+        m_workqueue.pop_front();
+        m_queuelocker.unlock();
+        return item;
+    }
+
+private:
+    std::deque<long> m_workqueue;
+    Locker m_queuelocker;
+    Sem m_queuestat;
+};
+
+// the queue and the parking of Threadpool::append and Threadpool::run
+class Lockfree_queue
+{
+public:
+    Lockfree_queue(): m_queue(MAX_REQUESTS) {}
+
+    bool append(long item)
+    {
+        if(!m_queue.push(item))
+        {
+            return false;
+        }
+        m_event.notify();
+        return true;
+    }
+
+    long take()
+    {
+        long item;
+        while(!m_queue.pop(item))
+        {
+            unsigned key = m_event.prepare_wait();
+            if(m_queue.pop(item))
+            {
+                m_event.cancel_wait();
+                break;
+            }
+            m_event.wait(key);
+        }
+        return item;
+    }
+
+private:
+    Mpmc_queue<long> m_queue;
+    Eventcount m_event;
+};
+
+template<class Q>
+struct Run
+{
+    Q queue;
+    std::atomic<long> taken;
+    long full; // append() refused, the producer retries
+};
+
+// -1 is the item that stops a consumer
+template<class Q>
+static void* consume(void* arg)
+{
+    Run<Q>* run = (Run<Q>*)arg;
+    while(true)
+    {
+        long item = run->queue.take();
+        if(item < 0)
+        {
+            break;
+        }
+        process(item);
+        run->taken.fetch_add(1, std::memory_order_relaxed);
+    }
+    return run;
+}
+
+// items per second through the queue with consumers threads
+template<class Q>
+static double measure(int consumers, long& full)
+{
+    Run<Q>* run = new Run<Q>;
+    run->taken = 0;
+    run->full = 0;
+    std::vector<pthread_t> threads(consumers);
+    for(int i = 0; i < consumers; i++)
+    {
+        pthread_create(&threads[i], NULL, consume<Q>, run);
+    }
+
+    long start = now_ns();
+    for(long i = 0; i < items; i++)
+    {
+        while(!run->queue.append(i))
+        {
+            run->full++;
+            sched_yield();
+        }
+    }
+    for(int i = 0; i < consumers; i++)
+    {
+        while(!run->queue.append(-1))
+        {
+            sched_yield();
+        }
+    }
+    for(int i = 0; i < consumers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    full = run->full;
+    delete run;
+    return items / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    int max_consumers = 8;
+    int opt;
+    while((opt = getopt(argc, argv, "n:c:w:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': items = atol(optarg); break;
+            case 'c': max_consumers = atoi(optarg); break;
+            case 'w': work = atoi(optarg); break;
+            default: break;
+        }
+    }
+
+    printf("1 producer, %ld items, %ld cpus\n", items, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %18s %12s %18s %12s\n", "consumers", "locked items/s", "full", "lock-free items/s", "full");
+    for(int consumers = 1; consumers <= max_consumers; consumers *= 2)
+    {
+        long locked_full, lockfree_full;
+        double locked = measure<Locked_queue>(consumers, locked_full);
+        double lockfree = measure<Lockfree_queue>(consumers, lockfree_full);
+        printf("%-10d %18.0f %12ld %18.0f %12ld\n", consumers, locked, locked_full, lockfree, lockfree_full);
+    }
+    return 0;
+}
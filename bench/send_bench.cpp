@@ -0,0 +1,189 @@
+/* the ways a static file leaves the server, over a loopback tcp connection drained by
+ * another thread: the header and an mmap of the file by writev, mapped per response as
+ * before the file cache or mapped once as the cache does below the sendfile threshold,
+ * and the header by send(MSG_MORE) followed by sendfile from a cached fd, see
+ * http_conn::write(). prints MB/s per file size, to pick m_sendfile_threshold (-s)
+ *
+ * send_bench [-f scratch file] [-m total MB per size] */
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void* drain(void* arg)
+{
+    int fd = *(int*)arg;
+    static char buf[1 << 20];
+    while(recv(fd, buf, sizeof(buf), 0) > 0)
+    {
+    }
+    return NULL;
+}
+
+static bool send_all(int sockfd, struct iovec* iv, int count)
+{
+    while(count > 0)
+    {
+        ssize_t n = writev(sockfd, iv, count);
+        if(n < 0)
+        {
+            return false;
+        }
+        while(count > 0 && (size_t)n >= iv->iov_len)
+        {
+            n -= iv->iov_len;
+            ++iv;
+            --count;
+        }
+        if(count > 0)
+        {
+            iv->iov_base = (char*)iv->iov_base + n;
+            iv->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+enum MODE {MMAP_EACH, MMAP_CACHED, SENDFILE};
+
+static bool respond(MODE mode, int sockfd, int filefd, char* cached, off_t size)
+{
+    if(mode == SENDFILE)
+    {
+        if(send(sockfd, header, sizeof(header) - 1, MSG_MORE | MSG_NOSIGNAL) < 0)
+        {
+            return false;
+        }
+        off_t offset = 0;
+        while(offset < size)
+        {
+            if(sendfile(sockfd, filefd, &offset, size - offset) <= 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    char* address = cached;
+    if(mode == MMAP_EACH)
+    {
+        address = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, filefd, 0);
+    }
+    struct iovec iv[2];
+    iv[0].iov_base = (char*)header;
+    iv[0].iov_len = sizeof(header) - 1;
+    iv[1].iov_base = address;
+    iv[1].iov_len = size;
+    bool ok = send_all(sockfd, iv, 2);
+    if(mode == MMAP_EACH)
+    {
+        munmap(address, size);
+    }
+    return ok;
+}
+
+// a connected pair of loopback tcp sockets
+static void connect_pair(int& client, int& server)
+{
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listenfd, (struct sockaddr*)&addr, sizeof(addr));
+    listen(listenfd, 1);
+    socklen_t len = sizeof(addr);
+    getsockname(listenfd, (struct sockaddr*)&addr, &len);
+
+    client = socket(PF_INET, SOCK_STREAM, 0);
+    connect(client, (struct sockaddr*)&addr, sizeof(addr));
+    server = accept(listenfd, NULL, NULL);
+    close(listenfd);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = "send_bench.tmp";
+    long total_mb = 512;
+    int opt;
+    while((opt = getopt(argc, argv, "f:m:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'f': path = optarg; break;
+            case 'm': total_mb = atol(optarg); break;
+            default: break;
+        }
+    }
+
+    const off_t sizes[] = {4 << 10, 64 << 10, 128 << 10, 1 << 20, 16 << 20, 128 << 20};
+    const char* names[] = {"mmap per response", "mmap cached", "sendfile"};
+    printf("MB/s over loopback, %ld MB per size\n", total_mb);
+    printf("%-10s %20s %20s %20s\n", "size", names[0], names[1], names[2]);
+    for(off_t size : sizes)
+    {
+        int filefd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        char* chunk = (char*)calloc(1, 1 << 20);
+        for(off_t written = 0; written < size; written += 1 << 20)
+        {
+            write(filefd, chunk, size - written < (1 << 20) ? size - written : (1 << 20));
+        }
+        free(chunk);
+        char* cached = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, filefd, 0);
+
+        long responses = (total_mb << 20) / size;
+        if(responses < 4)
+        {
+            responses = 4;
+        }
+        printf("%-10ld", (long)size);
+        for(int mode = MMAP_EACH; mode <= SENDFILE; mode++)
+        {
+            int client, server;
+            connect_pair(client, server);
+            pthread_t reader;
+            pthread_create(&reader, NULL, drain, &client);
+
+            long start = now_ns();
+            for(long i = 0; i < responses; i++)
+            {
+                respond((MODE)mode, server, filefd, cached, size);
+            }
+            close(server);
+            pthread_join(reader, NULL);
+            close(client);
+            double elapsed = (now_ns() - start) / 1e9;
+            printf(" %20.0f", responses * (double)size / (1 << 20) / elapsed);
+        }
+        printf("\n");
+
+        munmap(cached, size);
+        close(filefd);
+    }
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,201 @@
+/* Timer_wheel against the Timer_heap it replaced, with n idle connections. a loop
+ * iteration of the reactor refreshes the timers of the connections that had an event,
+ * then looks for expired timers. the heap changed expire in place, so it had to
+ * make_heap all n timers every iteration, the wheel relinks only the refreshed ones.
+ * accept and close are measured apart: the heap allocated a timer per accept and
+ * only dropped it once it reached the top
+ *
+ * timer_bench [-e events per iteration] [-i iterations] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "../timer.h"
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// the heap of before the wheel, less closing the fds
+struct Heap_timer
+{
+    time_t expire;
+    bool valid;
+};
+
+struct Heap_cmp
+{
+    bool operator() (Heap_timer* a, Heap_timer* b)
+    {
+        return a->expire > b->expire;
+    }
+};
+
+class Timer_heap
+{
+public:
+    Timer_heap(int max) {heap.reserve(max);}
+
+    void add_timer(Heap_timer* timer)
+    {
+        heap.push_back(timer);
+        push_heap(heap.begin(), heap.end(), Heap_cmp());
+    }
+    // the timer stayed in the heap until it reached the top
+    void del_timer(Heap_timer* timer)
+    {
+        timer->valid = false;
+        timer->expire = 1;
+    }
+    void adjust_timer(Heap_timer* timer, time_t delay) {timer->expire = now_ms() + delay;}
+    void reheap() {make_heap(heap.begin(), heap.end(), Heap_cmp());}
+    void tick()
+    {
+        time_t cur = now_ms();
+        while(!heap.empty() && heap.front()->expire <= cur)
+        {
+            Heap_timer* tmp = heap.front();
+            pop_heap(heap.begin(), heap.end(), Heap_cmp());
+            heap.pop_back();
+            delete tmp;
+        }
+    }
+
+private:
+    std::vector<Heap_timer*> heap;
+};
+
+static const time_t IDLE_MS = 15000;
+
+// ns per reactor iteration with n timers, events of them refreshed each time
+static double heap_iteration(int n, int events, int iterations)
+{
+    Timer_heap heap(n);
+    std::vector<Heap_timer*> timers(n);
+    for(int i = 0; i < n; i++)
+    {
+        timers[i] = new Heap_timer{now_ms() + IDLE_MS, true};
+        heap.add_timer(timers[i]);
+    }
+
+    long start = now_ns();
+    for(int it = 0; it < iterations; it++)
+    {
+        for(int e = 0; e < events; e++)
+        {
+            heap.adjust_timer(timers[rand() % n], IDLE_MS);
+        }
+        heap.reheap();
+        heap.tick();
+    }
+    double ns = (double)(now_ns() - start) / iterations;
+    for(Heap_timer* timer : timers)
+    {
+        delete timer;
+    }
+    return ns;
+}
+
+static double wheel_iteration(int n, int events, int iterations)
+{
+    Timer_wheel wheel;
+    std::vector<Timer> timers(n);
+    std::vector<Timer*> expired;
+    for(int i = 0; i < n; i++)
+    {
+        wheel.add_timer(&timers[i], IDLE_MS);
+    }
+
+    long start = now_ns();
+    for(int it = 0; it < iterations; it++)
+    {
+        for(int e = 0; e < events; e++)
+        {
+            wheel.adjust_timer(&timers[rand() % n], IDLE_MS);
+        }
+        wheel.next_timeout();
+        expired.clear();
+        wheel.tick(expired);
+    }
+    return (double)(now_ns() - start) / iterations;
+}
+
+// ns per accept and close of one connection, n connections open meanwhile
+static double heap_churn(int n)
+{
+    Timer_heap heap(2 * n);
+    std::vector<Heap_timer*> timers(n);
+    for(int i = 0; i < n; i++)
+    {
+        timers[i] = new Heap_timer{now_ms() + IDLE_MS, true};
+        heap.add_timer(timers[i]);
+    }
+
+    long start = now_ns();
+    for(int i = 0; i < n; i++)
+    {
+        heap.del_timer(timers[i]);
+        timers[i] = new Heap_timer{now_ms() + IDLE_MS, true};
+        heap.add_timer(timers[i]);
+    }
+    // the closed ones are freed once they come up
+    heap.reheap();
+    heap.tick();
+    double ns = (double)(now_ns() - start) / n;
+    for(Heap_timer* timer : timers)
+    {
+        delete timer;
+    }
+    return ns;
+}
+
+static double wheel_churn(int n)
+{
+    Timer_wheel wheel;
+    std::vector<Timer> timers(n);
+    for(int i = 0; i < n; i++)
+    {
+        wheel.add_timer(&timers[i], IDLE_MS);
+    }
+
+    long start = now_ns();
+    for(int i = 0; i < n; i++)
+    {
+        wheel.del_timer(&timers[i]);
+        wheel.add_timer(&timers[i], IDLE_MS);
+    }
+    return (double)(now_ns() - start) / n;
+}
+
+int main(int argc, char* argv[])
+{
+    int events = 100;
+    int iterations = 2000;
+    int opt;
+    while((opt = getopt(argc, argv, "e:i:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'e': events = atoi(optarg); break;
+            case 'i': iterations = atoi(optarg); break;
+            default: break;
+        }
+    }
+
+    const int sizes[] = {10000, 50000, 65000};
+    printf("%d events per iteration\n", events);
+    printf("%-8s %16s %16s %16s %16s\n", "timers", "heap ns/iter", "wheel ns/iter", "heap ns/conn", "wheel ns/conn");
+    for(int n : sizes)
+    {
+        srand(n);
+        double heap = heap_iteration(n, events, iterations);
+        srand(n);
+        double wheel = wheel_iteration(n, events, iterations);
+        printf("%-8d %16.0f %16.0f %16.1f %16.1f\n", n, heap, wheel, heap_churn(n), wheel_churn(n));
+    }
+    return 0;
+}
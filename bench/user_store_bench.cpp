@@ -0,0 +1,181 @@
+/* login throughput of User_store at 1..N threads, each checking random users for a
+ * while, against one unordered_map behind a single Rwlock: the global user_info made
+ * thread safe the simple way. with -w a thread keeps registering users meanwhile, as
+ * when a registration takes the write lock of a shard
+ *
+ * user_store_bench [-u users] [-t max threads] [-d ms per run] [-w registrations per second] */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../user_store.h"
+
+static int user_num = 100000;
+static int run_ms = 1000;
+static int register_rate = 0;
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static std::string username(int i)
+{
+    return "user" + std::to_string(i);
+}
+
+// the map of before, with one lock for all of it
+class Global_store
+{
+public:
+    bool insert(const std::string& username, const std::string& password)
+    {
+        m_lock.wrlock();
+        bool inserted = m_users.emplace(username, password).second;
+        m_lock.unlock();
+        return inserted;
+    }
+
+    bool check(const std::string& username, const std::string& password)
+    {
+        m_lock.rdlock();
+        auto it = m_users.find(username);
+        bool ok = it != m_users.end() && it->second == password;
+        m_lock.unlock();
+        return ok;
+    }
+
+private:
+    Rwlock m_lock;
+    std::unordered_map<std::string, std::string> m_users;
+};
+
+template<class S>
+struct Run
+{
+    S* store;
+    std::atomic<bool> stop;
+    std::atomic<long> logins;
+    std::vector<std::string> names;
+};
+
+template<class S>
+static void* login(void* arg)
+{
+    Run<S>* run = (Run<S>*)arg;
+    unsigned seed = (unsigned)(long)pthread_self();
+    long logins = 0;
+    while(!run->stop.load(std::memory_order_relaxed))
+    {
+        const std::string& name = run->names[rand_r(&seed) % run->names.size()];
+        logins += run->store->check(name, "password");
+    }
+    run->logins += logins;
+    return run;
+}
+
+template<class S>
+static void* register_users(void* arg)
+{
+    Run<S>* run = (Run<S>*)arg;
+    int i = user_num;
+    while(!run->stop.load(std::memory_order_relaxed))
+    {
+        run->store->insert(username(i++), "password");
+        usleep(1000000 / register_rate);
+    }
+    return run;
+}
+
+// logins per second with threads threads
+template<class S>
+static double measure(S* store, const std::vector<std::string>& names, int threads)
+{
+    Run<S> run;
+    run.store = store;
+    run.stop = false;
+    run.logins = 0;
+    run.names = names;
+
+    std::vector<pthread_t> workers(threads);
+    for(int i = 0; i < threads; i++)
+    {
+        pthread_create(&workers[i], NULL, login<S>, &run);
+    }
+    pthread_t writer;
+    if(register_rate > 0)
+    {
+        pthread_create(&writer, NULL, register_users<S>, &run);
+    }
+
+    long start = now_ns();
+    usleep(run_ms * 1000);
+    run.stop = true;
+    for(int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    if(register_rate > 0)
+    {
+        pthread_join(writer, NULL);
+    }
+    return run.logins / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while((opt = getopt(argc, argv, "u:t:d:w:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'u': user_num = atoi(optarg); break;
+            case 't': max_threads = atoi(optarg); break;
+            case 'd': run_ms = atoi(optarg); break;
+            case 'w': register_rate = atoi(optarg); break;
+            default: break;
+        }
+    }
+    if(max_threads < 1)
+    {
+        max_threads = 1;
+    }
+
+    std::vector<std::string> names;
+    User_store* sharded = new User_store;
+    Global_store* global = new Global_store;
+    for(int i = 0; i < user_num; i++)
+    {
+        names.push_back(username(i));
+        sharded->insert(names.back(), "password");
+        global->insert(names.back(), "password");
+    }
+
+    printf("%d users, %d registrations/s, %ld cpus\n", user_num, register_rate, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %16s %10s %16s %10s\n", "threads", "global logins/s", "speedup", "sharded logins/s", "speedup");
+    double global_one = 0, sharded_one = 0;
+    for(int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double g = measure(global, names, threads);
+        double s = measure(sharded, names, threads);
+        if(threads == 1)
+        {
+            global_one = g;
+            sharded_one = s;
+        }
+        printf("%-8d %16.0f %10.2f %16.0f %10.2f\n", threads, g, g / global_one, s, s / sharded_one);
+    }
+
+    delete global;
+    delete sharded;
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "buffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+namespace
+{
+
+// a free chunk holds the link to the next one
+struct Free_chunk
+{
+    Free_chunk* next;
+};
+
+struct Free_list
+{
+    Free_chunk* head;
+    int count;
+};
+
+/* the lists of one thread. chunks given back by other threads are pushed on remote and
+ * only the owner takes them off, all at once, so the stack can't suffer from ABA. the
+ * cache is never freed: a chunk may still come home after its thread has exited */
+struct Thread_cache
+{
+    Free_list local[Buffer_pool::CLASSES];
+    std::atomic<Free_chunk*> remote[Buffer_pool::CLASSES];
+};
+
+/* a pooled chunk is preceded by the cache of the thread which took it from malloc, so
+ * it goes back to that thread wherever it is freed. 16 bytes keep the chunk aligned */
+const size_t HEADER = 16;
+
+thread_local Thread_cache* cache = nullptr;
+
+Thread_cache* my_cache()
+{
+    if(!cache)
+    {
+        cache = new Thread_cache();
+    }
+    return cache;
+}
+
+Thread_cache*& owner(char* chunk)
+{
+    return *reinterpret_cast<Thread_cache**>(chunk - HEADER);
+}
+
+int size_class(size_t size)
+{
+    int cls = 0;
+    while((Buffer_pool::MIN_CHUNK << cls) < size)
+    {
+        ++cls;
+    }
+    return cls;
+}
+
+// keep chunk on list, or give it to malloc when the list is full
+void push_local(Free_list& list, Free_chunk* chunk)
+{
+    if(list.count == Buffer_pool::MAX_CACHED)
+    {
+        ::free(reinterpret_cast<char*>(chunk) - HEADER);
+        return;
+    }
+    chunk->next = list.head;
+    list.head = chunk;
+    ++list.count;
+}
+
+}
+
+char* Buffer_pool::alloc(size_t& size)
+{
+    if(size > MAX_CHUNK)
+    {
+        return static_cast<char*>(malloc(size));
+    }
+
+    int cls = size_class(size);
+    size = MIN_CHUNK << cls;
+
+    Thread_cache* self = my_cache();
+    Free_list& list = self->local[cls];
+    if(!list.head)
+    {
+        // take back what the other threads have freed since
+        Free_chunk* returned = self->remote[cls].exchange(nullptr, std::memory_order_acquire);
+        while(returned)
+        {
+            Free_chunk* next = returned->next;
+            push_local(list, returned);
+            returned = next;
+        }
+    }
+    if(list.head)
+    {
+        Free_chunk* chunk = list.head;
+        list.head = chunk->next;
+        --list.count;
+        return reinterpret_cast<char*>(chunk);
+    }
+
+    char* block = static_cast<char*>(malloc(size + HEADER));
+    if(!block)
+    {
+        return nullptr;
+    }
+    char* chunk = block + HEADER;
+    owner(chunk) = self;
+    return chunk;
+}
+
+void Buffer_pool::free(char* chunk, size_t size)
+{
+    if(size > MAX_CHUNK)
+    {
+        ::free(chunk);
+        return;
+    }
+
+    int cls = size_class(size);
+    Thread_cache* home = owner(chunk);
+    Free_chunk* node = reinterpret_cast<Free_chunk*>(chunk);
+    if(home == cache)
+    {
+        push_local(home->local[cls], node);
+        return;
+    }
+
+    std::atomic<Free_chunk*>& remote = home->remote[cls];
+    node->next = remote.load(std::memory_order_relaxed);
+    while(!remote.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+}
+
+bool Buffer::reserve(size_t need, size_t used, size_t limit)
+{
+    if(need <= m_size)
+    {
+        return true;
+    }
+    if(need > limit)
+    {
+        return false;
+    }
+
+    // at least double, so a request growing byte by byte only moves log(n) times
+    size_t size = m_size * 2 > need ? m_size * 2 : need;
+    if(size > limit)
+    {
+        size = limit;
+    }
+    char* data = Buffer_pool::alloc(size);
+    if(!data)
+    {
+        return false;
+    }
+
+    if(used)
+    {
+        memcpy(data, m_data, used);
+    }
+    release();
+    m_data = data;
+    m_size = size;
+    return true;
+}
+
+void Buffer::release()
+{
+    if(m_data)
+    {
+        Buffer_pool::free(m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
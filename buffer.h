@@ -0,0 +1,53 @@
+#pragma once
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+/* chunks of power of two sizes, from MIN_CHUNK to MAX_CHUNK. every thread keeps its own
+ * free list per size, so taking and giving back a chunk never locks. a chunk freed by
+ * another thread than the one which took it, as a write buffer filled by a worker and
+ * released by the reactor, is handed back to the owner through a lock free stack the
+ * owner empties when its own list runs dry */
+class Buffer_pool
+{
+public:
+    static const size_t MIN_CHUNK = 1024;
+    static const int CLASSES = 8; // 1K ... 128K
+    static const size_t MAX_CHUNK = MIN_CHUNK << (CLASSES - 1);
+
+    // chunks kept per size and thread, the surplus goes back to malloc
+    static const int MAX_CACHED = 64;
+
+    // size is rounded up to the size of the chunk returned
+    static char* alloc(size_t& size);
+    static void free(char* chunk, size_t size);
+};
+
+/* a contiguous buffer taken from Buffer_pool, which grows by moving its bytes to a
+ * larger chunk. the parser works on '\0' terminated lines, so the bytes are kept in
+ * one piece rather than a chain of chunks */
+class Buffer
+{
+public:
+    Buffer(): m_data(nullptr), m_size(0) {}
+    ~Buffer() {release();}
+
+    char* data() const {return m_data;}
+    size_t size() const {return m_size;}
+
+    // make room for need bytes, keeping the first used ones. false beyond limit
+    bool reserve(size_t need, size_t used, size_t limit);
+
+    // give the chunk back to the pool
+    void release();
+
+private:
+    Buffer(const Buffer&);
+    Buffer& operator=(const Buffer&);
+
+    char* m_data;
+    size_t m_size;
+};
+
+#endif
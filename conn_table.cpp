@@ -0,0 +1,42 @@
+#include "conn_table.h"
+
+Conn_table::Conn_table(int max_fd): m_max_fd(max_fd), m_made(0)
+{
+    m_slots = new std::atomic<http_conn*>[m_max_fd];
+    for(int i = 0; i < m_max_fd; i++)
+    {
+        m_slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+Conn_table::~Conn_table()
+{
+    for(http_conn* slab : m_slabs)
+    {
+        delete [] slab;
+    }
+    delete [] m_slots;
+}
+
+/* an fd belongs to one reactor at a time, but it may be accepted by another one
+ * once closed: the acquire/release pair hands the object over between them */
+http_conn* Conn_table::get(int fd)
+{
+    http_conn* conn = find(fd);
+    if(conn)
+    {
+        return conn;
+    }
+
+    m_lock.lock();
+    if(m_made % SLAB == 0)
+    {
+        m_slabs.push_back(new http_conn[SLAB]);
+    }
+    conn = m_slabs.back() + m_made % SLAB;
+    m_made++;
+    m_lock.unlock();
+
+    m_slots[fd].store(conn, std::memory_order_release);
+    return conn;
+}
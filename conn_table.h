@@ -0,0 +1,44 @@
+#pragma once
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <atomic>
+#include <vector>
+#include "http_conn.h"
+#include "locker.h"
+
+/* the http_conn of every fd, shared by all the reactors. only a table of pointers is
+ * allocated up front: a connection object is made the first time its fd is accepted,
+ * carved out of a slab of SLAB objects, and kept for the next connection on that fd.
+ * the memory thus follows the number of fds open at the same time, not MAX_FD */
+class Conn_table
+{
+public:
+    explicit Conn_table(int max_fd);
+    ~Conn_table();
+
+    // the connection of a freshly accepted fd, made on first use
+    http_conn* get(int fd);
+
+    // the connection of an fd already accepted
+    http_conn* find(int fd) const {return m_slots[fd].load(std::memory_order_acquire);}
+
+    // connection objects made so far
+    int slots() const {return m_made;}
+
+private:
+    Conn_table(const Conn_table&) = delete;
+    Conn_table& operator=(const Conn_table&) = delete;
+
+    static const int SLAB = 64;
+
+    int m_max_fd;
+    std::atomic<http_conn*>* m_slots;
+
+    // the reactors accept concurrently, so carving the slabs is locked
+    Locker m_lock;
+    std::vector<http_conn*> m_slabs;
+    int m_made;
+};
+
+#endif
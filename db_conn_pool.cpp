@@ -1,9 +1,19 @@
 #include "db_conn_pool.h"
+#include <mysql/errmsg.h>
+#include <vector>
+#include "timer.h"
 
-db_conn_pool::db_conn_pool()
+static long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+db_conn_pool::db_conn_pool():
+    m_min_conn(0), m_max_conn(0), m_cur_conn(0), m_free_conn(0),
+    m_acquired(0), m_wait_us(0), m_created(0), m_closed(0), m_failed(0), m_timeouts(0)
 {
-    m_cur_conn = 0;
-    m_free_conn = 0;
 }
 
 db_conn_pool* db_conn_pool::get_instance()
@@ -13,7 +23,7 @@ db_conn_pool* db_conn_pool::get_instance()
 }
 
 void db_conn_pool::init(const std::string& url, const std::string& user, const std::string& password, const std::string& databasename,
-          int port, int maxconn)
+          int port, int min_conn, int max_conn)
 {
     m_url = url;
     m_port = port;
@@ -21,48 +31,124 @@ void db_conn_pool::init(const std::string& url, const std::string& user, const s
     m_databasename = databasename;
     m_password = password;
 
-    for(int i=0; i < maxconn; i++)
+    m_min_conn = min_conn > 0 ? min_conn : 0;
+    m_max_conn = max_conn > m_min_conn ? max_conn : m_min_conn;
+    if(m_max_conn == 0)
     {
-        MYSQL* con = nullptr;
-        con = mysql_init(con);
-
-        if(!con)
-        {
-            return;
-        }
-        con = mysql_real_connect(con, url.c_str(), user.c_str(), password.c_str(), databasename.c_str(), port, NULL, 0);
+        m_max_conn = 1;
+    }
+    for(int i = 0; i < m_max_conn; i++)
+    {
+        sem.post();
+    }
 
+    // a server not up yet is no reason to give up, get_connection() connects again
+    time_t now = now_ms();
+    for(int i = 0; i < m_min_conn; i++)
+    {
+        MYSQL* con = connect();
         if(!con)
         {
-            return;
+            break;
         }
-        
-        connlist.push_back(con);
+        connlist.push_back(Idle_conn{con, now});
         ++m_free_conn;
     }
+}
+
+MYSQL* db_conn_pool::connect()
+{
+    MYSQL* con = mysql_init(nullptr);
+    if(!con)
+    {
+        ++m_failed;
+        return nullptr;
+    }
+
+    // a dead server must not keep the caller longer than that
+    unsigned int timeout = (ACQUIRE_TIMEOUT_MS + 999) / 1000;
+    mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
 
-    sem = Sem(m_free_conn);
-    m_max_conn = m_free_conn;
+    if(!mysql_real_connect(con, m_url.c_str(), m_user.c_str(), m_password.c_str(), m_databasename.c_str(), m_port, NULL, 0))
+    {
+        mysql_close(con);
+        ++m_failed;
+        return nullptr;
+    }
+    ++m_created;
+    return con;
 }
 
-MYSQL* db_conn_pool::get_connection()
+// take the idle connections beyond min_conn unused for IDLE_TIMEOUT_MS out of the list
+void db_conn_pool::shrink(time_t now, std::vector<MYSQL*>& expired)
 {
-    MYSQL* con = nullptr;
-    if(connlist.empty())
+    while(!connlist.empty() && m_cur_conn + m_free_conn > m_min_conn
+          && now - connlist.back().since > IDLE_TIMEOUT_MS)
     {
+        expired.push_back(connlist.back().conn);
+        connlist.pop_back();
+        --m_free_conn;
+    }
+}
+
+MYSQL* db_conn_pool::get_connection(int timeout_ms)
+{
+    long start = now_us();
+
+    // a post of sem is either an idle connection or room to open one
+    if(!sem.timed_wait(timeout_ms))
+    {
+        ++m_timeouts;
         return nullptr;
     }
 
-    sem.wait();
+    time_t now = now_ms();
+    MYSQL* con = nullptr;
+    time_t since = now;
+    std::vector<MYSQL*> expired;
+
     locker.lock();
+    if(!connlist.empty())
+    {
+        con = connlist.front().conn;
+        since = connlist.front().since;
+        connlist.pop_front();
+        --m_free_conn;
+    }
+    ++m_cur_conn;
+    shrink(now, expired);
+    locker.unlock();
 
-    con = connlist.front();
-    connlist.pop_front();
+    for(MYSQL* idle : expired)
+    {
+        mysql_close(idle);
+        ++m_closed;
+    }
 
-    --m_free_conn;
-    ++m_cur_conn;
+    // mysql may have dropped one which sat idle, its wait_timeout for instance
+    if(con && now - since > PING_AFTER_MS && mysql_ping(con) != 0)
+    {
+        mysql_close(con);
+        ++m_failed;
+        ++m_closed;
+        con = nullptr;
+    }
+    if(!con)
+    {
+        con = connect();
+    }
 
-    locker.unlock();
+    if(!con)
+    {
+        locker.lock();
+        --m_cur_conn;
+        locker.unlock();
+        sem.post();
+        return nullptr;
+    }
+
+    ++m_acquired;
+    m_wait_us += now_us() - start;
     return con;
 }
 
@@ -73,13 +159,24 @@ bool db_conn_pool::release_connection(MYSQL* conn)
         return false;
     }
 
-    locker.lock();
+    // the link broke during the last query: close it, the next taker opens a new one
+    unsigned int err = mysql_errno(conn);
+    bool lost = err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+    if(lost)
+    {
+        mysql_close(conn);
+        ++m_closed;
+    }
 
-    connlist.push_back(conn);
-    ++m_free_conn;
+    locker.lock();
+    if(!lost)
+    {
+        connlist.push_front(Idle_conn{conn, now_ms()});
+        ++m_free_conn;
+    }
     --m_cur_conn;
-
     locker.unlock();
+
     sem.post();
     return true;
 }
@@ -87,16 +184,12 @@ bool db_conn_pool::release_connection(MYSQL* conn)
 void db_conn_pool::destroy_conn_pool()
 {
     locker.lock();
-    if(!connlist.empty())
+    for(const Idle_conn& idle : connlist)
     {
-        for(auto con : connlist)
-        {
-            mysql_close(con);
-        }
-        m_cur_conn = 0;
-        m_free_conn = 0;
-        connlist.clear();
+        mysql_close(idle.conn);
     }
+    m_free_conn = 0;
+    connlist.clear();
     locker.unlock();
 }
 
@@ -105,6 +198,22 @@ int db_conn_pool::get_freeconn_num()
     return m_free_conn;
 }
 
+db_conn_pool::Stats db_conn_pool::stats()
+{
+    Stats stats;
+    locker.lock();
+    stats.in_use = m_cur_conn;
+    stats.idle = m_free_conn;
+    locker.unlock();
+    stats.acquired = m_acquired;
+    stats.wait_us = m_wait_us;
+    stats.created = m_created;
+    stats.closed = m_closed;
+    stats.failed = m_failed;
+    stats.timeouts = m_timeouts;
+    return stats;
+}
+
 db_conn_pool::~db_conn_pool()
 {
     destroy_conn_pool();
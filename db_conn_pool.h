@@ -3,40 +3,85 @@
 #define DB_CONN_POOL
 
 #include <mysql/mysql.h>
+#include <atomic>
 #include <list>
+#include <vector>
 #include <string>
+#include <time.h>
 #include "locker.h"
 
-// singleton
+/* singleton. min_conn connections are opened by init() and the pool grows on demand up
+ * to max_conn, the connections idle for more than IDLE_TIMEOUT_MS are closed again down
+ * to min_conn. a connection idle for more than PING_AFTER_MS is pinged before it is
+ * handed out, and reopened if mysql has dropped it */
 class db_conn_pool
 {
 public:
+    static const int IDLE_TIMEOUT_MS = 60000;
+    static const int PING_AFTER_MS = 5000;
+    static const int ACQUIRE_TIMEOUT_MS = 1000;
+
     static db_conn_pool* get_instance();
     void init(const std::string& url, const std::string& user, const std::string& password, const std::string& databasename,
-              int port, int maxconn);
-    MYSQL* get_connection();
+              int port, int min_conn, int max_conn);
+
+    /* nullptr if no connection could be had within timeout_ms, either because all of
+     * max_conn are in use or because mysql can't be reached. the caller fails its
+     * request instead of hanging */
+    MYSQL* get_connection(int timeout_ms = ACQUIRE_TIMEOUT_MS);
     bool release_connection(MYSQL* conn);
     int get_freeconn_num();
+    int get_maxconn_num() const {return m_max_conn;}
     void destroy_conn_pool();
 
+    struct Stats
+    {
+        long acquired; // get_connection() which returned a connection
+        long wait_us; // time spent in them, waiting and connecting
+        long in_use;
+        long idle;
+        long created; // connections opened, reconnects included
+        long closed; // idle ones shrunk and dead ones dropped
+        long failed; // connects and pings which failed
+        long timeouts; // get_connection() which gave up
+    };
+    Stats stats();
+
 private:
     db_conn_pool();
     ~db_conn_pool();
-    
+
+    struct Idle_conn
+    {
+        MYSQL* conn;
+        time_t since; // released at, see now_ms()
+    };
+
+    MYSQL* connect();
+    void shrink(time_t now, std::vector<MYSQL*>& expired);
+
+    int m_min_conn;
     int m_max_conn;
-    int m_cur_conn;
-    int m_free_conn;
-    Locker locker;
-    Sem sem;
+    int m_cur_conn; // in use
+    int m_free_conn; // idle
+    Locker locker; // protects connlist and the counts above
+    Sem sem; // one post per connection which may be taken or opened, max_conn in all
 
-    std::list<MYSQL*> connlist;
+    // most recently released first, so the idle ones to shrink sit at the back
+    std::list<Idle_conn> connlist;
 
     std::string m_url; // address
-    int m_port; // port of mysql  
+    int m_port; // port of mysql
     std::string m_user; // user name of mysql
     std::string m_password;
     std::string m_databasename;
 
+    std::atomic<long> m_acquired;
+    std::atomic<long> m_wait_us;
+    std::atomic<long> m_created;
+    std::atomic<long> m_closed;
+    std::atomic<long> m_failed;
+    std::atomic<long> m_timeouts;
 };
 
 #endif
@@ -0,0 +1,145 @@
+#include "db_executor.h"
+#include "timer.h"
+
+Db_executor::Db_executor(db_conn_pool* pool, int batch_rows, int batch_ms):
+    m_pool(pool), m_stop(false), m_batch_rows(batch_rows), m_batch_ms(batch_ms),
+    m_batches(0), m_rows_written(0), m_rows_failed(0)
+{
+    if(batch_rows <= 0)
+    {
+        throw std::exception();
+    }
+    if(pthread_create(&m_writer, NULL, writer, this) != 0)
+    {
+        throw std::exception();
+    }
+}
+
+// the rows already queued are still written before the thread quits
+Db_executor::~Db_executor()
+{
+    m_lock.lock();
+    m_stop = true;
+    m_lock.unlock();
+    m_rows_queued.post();
+    pthread_join(m_writer, NULL);
+}
+
+void Db_executor::insert_user(const std::string& username, const std::string& password, Callback done)
+{
+    m_lock.lock();
+    m_rows.push_back(Row{username, password, std::move(done)});
+    m_lock.unlock();
+    m_rows_queued.post();
+}
+
+void* Db_executor::writer(void* arg)
+{
+    Db_executor* executor = (Db_executor*)arg;
+    executor->write_behind();
+    return executor;
+}
+
+/* the first row of a batch starts its clock: the rows coming in the next m_batch_ms
+ * join it, unless m_batch_rows are there before */
+void Db_executor::write_behind()
+{
+    std::vector<Row> batch;
+    while(true)
+    {
+        m_rows_queued.wait();
+        time_t deadline = now_ms() + m_batch_ms;
+        int taken = 1;
+        while(taken < m_batch_rows)
+        {
+            time_t left = deadline - now_ms();
+            if(left <= 0 || !m_rows_queued.timed_wait(left))
+            {
+                break;
+            }
+            ++taken;
+        }
+
+        m_lock.lock();
+        bool stop = m_stop;
+        // one of the posts taken may be the one of the stop, which flushes everything left
+        while(!m_rows.empty() && (stop || (int)batch.size() < taken))
+        {
+            batch.push_back(std::move(m_rows.front()));
+            m_rows.pop_front();
+        }
+        m_lock.unlock();
+
+        if(!batch.empty())
+        {
+            flush(batch);
+            batch.clear();
+        }
+        if(stop)
+        {
+            break;
+        }
+    }
+}
+
+/* the whole batch goes in one multi-row INSERT, a single statement and so a single
+ * transaction: its rows are committed together when it succeeds. if it fails, the rows
+ * are tried one at a time, so only the offending ones are reported */
+void Db_executor::flush(std::vector<Row>& batch)
+{
+    MYSQL* mysql = m_pool->get_connection();
+    int n = batch.size();
+    if(mysql && insert(mysql, batch.data(), n))
+    {
+        m_pool->release_connection(mysql);
+        ++m_batches;
+        m_rows_written += n;
+        for(Row& row : batch)
+        {
+            row.done(true);
+        }
+        return;
+    }
+
+    std::vector<bool> ok(n, false);
+    for(int i = 0; i < n; i++)
+    {
+        ok[i] = mysql && insert(mysql, &batch[i], 1);
+    }
+    m_pool->release_connection(mysql);
+    ++m_batches;
+    for(int i = 0; i < n; i++)
+    {
+        if(ok[i])
+        {
+            ++m_rows_written;
+        }
+        else
+        {
+            ++m_rows_failed;
+        }
+        batch[i].done(ok[i]);
+    }
+}
+
+// the values are escaped by the client library, they come straight from the form
+bool Db_executor::insert(MYSQL* mysql, const Row* rows, int count)
+{
+    std::string sql = "insert into user(username, password) values";
+    std::vector<char> escaped;
+    for(int i = 0; i < count; i++)
+    {
+        const std::string* values[2] = {&rows[i].username, &rows[i].password};
+        sql += i ? ", (" : "(";
+        for(int j = 0; j < 2; j++)
+        {
+            escaped.resize(values[j]->size() * 2 + 1);
+            unsigned long len = mysql_real_escape_string(mysql, escaped.data(), values[j]->c_str(), values[j]->size());
+            sql += j ? ", '" : "'";
+            sql.append(escaped.data(), len);
+            sql += "'";
+        }
+        sql += ")";
+    }
+    return mysql_real_query(mysql, sql.c_str(), sql.size()) == 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef DB_EXECUTOR_H
+#define DB_EXECUTOR_H
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "db_conn_pool.h"
+#include "locker.h"
+
+/* writes the registered users on a thread of its own, so a worker thread never waits
+ * for a connection or for mysql. the worker queues the row with a callback and moves
+ * on, the callback is called on the db thread once the row is committed and completes
+ * the response, see http_conn::complete_register */
+class Db_executor
+{
+public:
+    typedef std::function<void(bool ok)> Callback;
+
+    /* the rows are inserted by batches of up to batch_rows, a batch being flushed
+     * batch_ms after its first row at the latest */
+    Db_executor(db_conn_pool* pool, int batch_rows = 64, int batch_ms = 10);
+    ~Db_executor();
+
+    /* queue a new user for the next batch. done is called once the batch is committed,
+     * ok is false if the row could not be inserted */
+    void insert_user(const std::string& username, const std::string& password, Callback done);
+
+    // batches written, rows written and rows which failed
+    long batches() const {return m_batches;}
+    long rows() const {return m_rows_written;}
+    long failed() const {return m_rows_failed;}
+
+private:
+    static void* writer(void* arg);
+    void write_behind();
+
+    struct Row
+    {
+        std::string username;
+        std::string password;
+        Callback done;
+    };
+
+    void flush(std::vector<Row>& batch);
+    bool insert(MYSQL* mysql, const Row* rows, int count);
+
+    db_conn_pool* m_pool;
+    pthread_t m_writer;
+
+    Locker m_lock; // protects m_rows and m_stop
+    bool m_stop;
+
+    std::list<Row> m_rows;
+    Sem m_rows_queued; // one post per row, and one to stop the writer
+    int m_batch_rows;
+    int m_batch_ms;
+
+    std::atomic<long> m_batches;
+    std::atomic<long> m_rows_written;
+    std::atomic<long> m_rows_failed;
+};
+
+#endif
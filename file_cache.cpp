@@ -0,0 +1,489 @@
+#include "file_cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// files smaller than this hardly shrink below the size of the gzip framing
+static const size_t MIN_GZIP_SIZE = 256;
+
+// the text types worth compressing, by extension
+static bool compressible(const char* path)
+{
+    static const char* extensions[] = {".html", ".htm", ".css", ".js", ".txt", ".json", ".svg", ".xml"};
+    const char* dot = strrchr(path, '.');
+    if(!dot)
+    {
+        return false;
+    }
+    for(const char* extension : extensions)
+    {
+        if(strcasecmp(dot, extension) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// gzip data into out, false if it doesn't save at least an eighth
+static bool gzip_compress(const char* data, size_t size, std::string& out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 16 + the default window bits asks zlib for the gzip framing
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+    out.resize(deflateBound(&zs, size));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in = size;
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    size_t produced = out.size() - zs.avail_out;
+    deflateEnd(&zs);
+
+    if(ret != Z_STREAM_END || produced > size - size / 8)
+    {
+        out.clear();
+        return false;
+    }
+    out.resize(produced);
+    out.shrink_to_fit();
+    return true;
+}
+
+File_entry::~File_entry()
+{
+    if(address && !bundled)
+    {
+        munmap(address, size);
+    }
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+File_cache::File_cache()
+{
+    m_shard_bytes = 0;
+    m_shard_fds = 0;
+    m_map_limit = 0;
+    m_inotifyfd = -1;
+    m_bundle_address = nullptr;
+    m_bundle_size = 0;
+    for(int i = 0; i < SHARDS; i++)
+    {
+        m_shards[i].bytes = 0;
+        m_shards[i].fds = 0;
+        m_shards[i].generation = 0;
+    }
+}
+
+File_cache::~File_cache()
+{
+    if(m_inotifyfd >= 0)
+    {
+        close(m_inotifyfd);
+    }
+    if(m_bundle_address)
+    {
+        munmap(m_bundle_address, m_bundle_size);
+    }
+}
+
+File_cache* File_cache::get_instance()
+{
+    static File_cache cache;
+    return &cache;
+}
+
+void File_cache::init(const std::string& root, size_t max_bytes, size_t map_limit)
+{
+    m_shard_bytes = max_bytes / SHARDS;
+    // a quarter of the fds for the files, so a doc_root of large files can't starve accept()
+    struct rlimit limit;
+    rlim_t fds = 1024;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        fds = limit.rlim_cur;
+    }
+    m_shard_fds = fds / 4 / SHARDS;
+    if(m_shard_fds < 1)
+    {
+        m_shard_fds = 1;
+    }
+    m_map_limit = map_limit;
+    m_root = root;
+    m_inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(m_inotifyfd >= 0)
+    {
+        watch(root);
+    }
+}
+
+// watch dir and all its subdirectories
+void File_cache::watch(const std::string& dir)
+{
+    int wd = inotify_add_watch(m_inotifyfd, dir.c_str(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE |
+                               IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF);
+    if(wd < 0)
+    {
+        return;
+    }
+    m_watches[wd] = dir;
+
+    DIR* d = opendir(dir.c_str());
+    if(!d)
+    {
+        return;
+    }
+    struct dirent* ent;
+    while((ent = readdir(d)) != nullptr)
+    {
+        if(ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+        {
+            watch(dir + "/" + ent->d_name);
+        }
+    }
+    closedir(d);
+}
+
+File_cache::Shard& File_cache::shard(const std::string& path)
+{
+    return m_shards[std::hash<std::string>()(path) % SHARDS];
+}
+
+int File_cache::load(const char* path, File_ref& entry)
+{
+    entry = std::make_shared<File_entry>();
+    entry->path = path;
+    if(stat(path, &entry->st) < 0)
+    {
+        return errno;
+    }
+    if(!(entry->st.st_mode & S_IROTH)) // if not readable
+    {
+        return EACCES;
+    }
+    if(!S_ISREG(entry->st.st_mode)) // if it's a directory or so
+    {
+        return EISDIR;
+    }
+
+    entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(entry->fd < 0)
+    {
+        return errno;
+    }
+
+    entry->size = entry->st.st_size;
+    if(entry->size && entry->size < m_map_limit)
+    {
+        void* address = mmap(NULL, entry->size, PROT_READ, MAP_PRIVATE, entry->fd, 0);
+        if(address == MAP_FAILED)
+        {
+            return errno;
+        }
+        entry->address = static_cast<char*>(address);
+    }
+    if(entry->address || !entry->size)
+    {
+        // only sendfile needs the fd, the mapping stays valid without it
+        close(entry->fd);
+        entry->fd = -1;
+    }
+
+    describe(*entry);
+    return 0;
+}
+
+// headers and gzip variant of an entry whose stat and content are there
+void File_cache::describe(File_entry& entry)
+{
+    // a change on disk drops the entry through inotify, so they are computed once
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%lx-%lx\"", (unsigned long)entry.st.st_size,
+             (unsigned long)(entry.st.st_mtim.tv_sec * 1000000000L + entry.st.st_mtim.tv_nsec));
+    entry.etag = buf;
+    struct tm tm;
+    gmtime_r(&entry.st.st_mtime, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    std::string last_modified = std::string("Last-Modified: ") + buf + "\r\n";
+    entry.headers = "ETag: " + entry.etag + "\r\n" + last_modified;
+
+    /* compressed once, at preload() or on the first request. the entry is dropped when
+     * the file changes, so the next request compresses the new content */
+    if(entry.address && entry.size >= MIN_GZIP_SIZE && compressible(entry.path.c_str())
+       && gzip_compress(entry.address, entry.size, entry.gzip))
+    {
+        const char* vary = "Vary: Accept-Encoding\r\n";
+        entry.gzip_etag = entry.etag.substr(0, entry.etag.size() - 1) + "-gz\"";
+        entry.headers += vary;
+        entry.gzip_headers = "ETag: " + entry.gzip_etag + "\r\n" + last_modified + vary
+                             + "Content-Encoding: gzip\r\n";
+    }
+}
+
+// the files of dir and its subdirectories that preload() can pack
+void File_cache::collect(const std::string& dir, std::vector<File_ref>& files, size_t& bytes, size_t max_bytes)
+{
+    DIR* d = opendir(dir.c_str());
+    if(!d)
+    {
+        return;
+    }
+    struct dirent* ent;
+    while((ent = readdir(d)) != nullptr)
+    {
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+        {
+            continue;
+        }
+        File_ref entry = std::make_shared<File_entry>();
+        entry->path = dir + "/" + ent->d_name;
+        if(stat(entry->path.c_str(), &entry->st) < 0)
+        {
+            continue;
+        }
+        if(S_ISDIR(entry->st.st_mode))
+        {
+            collect(entry->path, files, bytes, max_bytes);
+        }
+        else if(S_ISREG(entry->st.st_mode) && (entry->st.st_mode & S_IROTH) && entry->st.st_size > 0
+                && (size_t)entry->st.st_size < m_map_limit && bytes + entry->st.st_size <= max_bytes)
+        {
+            entry->size = entry->st.st_size;
+            bytes += entry->size;
+            files.push_back(entry);
+        }
+    }
+    closedir(d);
+}
+
+// read size bytes from the start of fd, false if the file is shorter
+static bool read_file(int fd, char* buf, size_t size)
+{
+    size_t done = 0;
+    while(done < size)
+    {
+        ssize_t ret = pread(fd, buf + done, size - done, done);
+        if(ret <= 0)
+        {
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+/* the content of all the files is copied into one memfd, mapped once and then made
+ * read-only, so serving them takes no fd, no mapping of their own and no syscall.
+ * the watches of init() are already set, so a file changed while being copied is
+ * marked stale by the inotify event that follows */
+void File_cache::preload(const std::string& root, size_t max_bytes)
+{
+    std::vector<File_ref> files;
+    size_t bytes = 0;
+    collect(root, files, bytes, max_bytes);
+    if(files.empty())
+    {
+        return;
+    }
+
+    int fd = memfd_create("doc_root", MFD_CLOEXEC);
+    if(fd < 0)
+    {
+        return;
+    }
+    void* address = MAP_FAILED;
+    if(ftruncate(fd, bytes) == 0)
+    {
+        address = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(address == MAP_FAILED)
+    {
+        return;
+    }
+    m_bundle_address = static_cast<char*>(address);
+    m_bundle_size = bytes;
+
+    size_t offset = 0;
+    for(File_ref& entry : files)
+    {
+        int file = open(entry->path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(file < 0)
+        {
+            continue;
+        }
+        bool ok = read_file(file, m_bundle_address + offset, entry->size);
+        close(file);
+        if(!ok) // shrunk meanwhile, left to the shards
+        {
+            continue;
+        }
+
+        entry->address = m_bundle_address + offset;
+        entry->bundled = true;
+        describe(*entry);
+        m_bundle[entry->path] = entry;
+        offset += entry->size;
+    }
+    mprotect(m_bundle_address, m_bundle_size, PROT_READ);
+}
+
+int File_cache::get(const char* path, File_ref& entry)
+{
+    std::string key(path);
+
+    // the bundle never changes after preload(), a hit takes no lock at all
+    auto bundled = m_bundle.find(key);
+    if(bundled != m_bundle.end() && !bundled->second->stale)
+    {
+        entry = bundled->second;
+        return 0;
+    }
+
+    Shard& s = shard(key);
+    s.locker.lock();
+    auto it = s.map.find(key);
+    if(it != s.map.end())
+    {
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        entry = *it->second;
+        s.locker.unlock();
+        return 0;
+    }
+    unsigned generation = s.generation;
+    s.locker.unlock();
+
+    // the syscalls of a miss run outside of the lock
+    int ret = load(path, entry);
+    if(ret != 0)
+    {
+        entry.reset();
+        return ret;
+    }
+
+    // files larger than a shard are served once and never cached
+    if(entry->cost() > m_shard_bytes)
+    {
+        return 0;
+    }
+
+    s.locker.lock();
+    it = s.map.find(key);
+    if(it != s.map.end())
+    {
+        // loaded by another thread meanwhile
+        entry = *it->second;
+    }
+    else if(generation == s.generation)
+    {
+        s.lru.push_front(entry);
+        s.map[key] = s.lru.begin();
+        s.bytes += entry->cost();
+        s.fds += entry->fd >= 0;
+        while(s.bytes > m_shard_bytes || s.fds > m_shard_fds)
+        {
+            File_ref& victim = s.lru.back();
+            s.bytes -= victim->cost();
+            s.fds -= victim->fd >= 0;
+            s.map.erase(victim->path);
+            s.lru.pop_back();
+        }
+    }
+    s.locker.unlock();
+    return 0;
+}
+
+void File_cache::invalidate(const std::string& path)
+{
+    auto bundled = m_bundle.find(path);
+    if(bundled != m_bundle.end())
+    {
+        bundled->second->stale = true;
+    }
+
+    Shard& s = shard(path);
+    s.locker.lock();
+    ++s.generation;
+    auto it = s.map.find(path);
+    if(it != s.map.end())
+    {
+        s.bytes -= (*it->second)->cost();
+        s.fds -= (*it->second)->fd >= 0;
+        s.lru.erase(it->second);
+        s.map.erase(it);
+    }
+    s.locker.unlock();
+}
+
+void File_cache::invalidate_all()
+{
+    for(auto& bundled : m_bundle)
+    {
+        bundled.second->stale = true;
+    }
+
+    for(Shard& s : m_shards)
+    {
+        s.locker.lock();
+        ++s.generation;
+        s.lru.clear();
+        s.map.clear();
+        s.bytes = 0;
+        s.fds = 0;
+        s.locker.unlock();
+    }
+}
+
+void File_cache::handle_inotify()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true)
+    {
+        int len = read(m_inotifyfd, buf, sizeof(buf));
+        if(len <= 0)
+        {
+            break;
+        }
+
+        for(char* p = buf; p < buf + len; )
+        {
+            struct inotify_event* event = (struct inotify_event*)p;
+
+            /* the queue overflowed and some events are gone, along with the directories
+             * they created: drop everything and watch the whole tree again */
+            if(event->mask & IN_Q_OVERFLOW)
+            {
+                invalidate_all();
+                watch(m_root);
+            }
+
+            auto it = m_watches.find(event->wd);
+            if(it != m_watches.end() && event->len)
+            {
+                std::string path = it->second + "/" + event->name;
+                invalidate(path);
+                if((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR))
+                {
+                    watch(path);
+                }
+            }
+            if(event->mask & IN_IGNORED)
+            {
+                m_watches.erase(event->wd);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "locker.h"
+
+// an open and mapped static file, it stays valid as long as somebody holds a File_ref
+struct File_entry
+{
+    File_entry(): fd(-1), address(nullptr), size(0), bundled(false), stale(false) {}
+    ~File_entry();
+
+    std::string path;
+    struct stat st;
+    int fd; // only kept by a file served by sendfile, -1 once it is mapped or if it's empty
+    char* address; // nullptr for an empty file or one too large to be mapped
+    size_t size;
+
+    // address points into the bundle of File_cache::preload(), fd is -1
+    bool bundled;
+    // a bundled file changed on disk, it is served through the shards from then on
+    std::atomic<bool> stale;
+
+    // validators of the content, from the size and mtime of the file
+    std::string etag; // quoted, as in the header
+    std::string headers; // "ETag: ...\r\nLast-Modified: ...\r\n", and Vary if there is a gzip variant
+
+    // gzip variant of a compressible mapped file, empty if there is none
+    std::string gzip;
+    std::string gzip_etag;
+    std::string gzip_headers; // same as headers, plus Content-Encoding
+
+    // bytes charged to the cache, an unmapped file only holds its fd, see m_shard_fds
+    size_t cost() const {return (address ? size : 4096) + gzip.size();}
+};
+
+typedef std::shared_ptr<File_entry> File_ref;
+
+/* cache of the static files under doc_root, keyed by path(singleton).
+ * entries are reference counted, so evicting or invalidating one never pulls the
+ * mapping from under a writev in flight. every shard keeps its own lock and LRU list,
+ * bounded by its share of the total bytes and of the fds the cache may keep open. a file changed on disk is dropped through
+ * inotify, handle_inotify() is called by the reactor watching inotify_fd() */
+class File_cache
+{
+public:
+    static File_cache* get_instance();
+    /* files from map_limit bytes on are kept open but not mapped, see File_entry::cost().
+     * the fds so held are bounded by a share of RLIMIT_NOFILE, the rest is for connections */
+    void init(const std::string& root, size_t max_bytes, size_t map_limit);
+
+    /* pack the files under root that would be mapped into a single mapping, up to
+     * max_bytes in all, along with their headers and gzip variants. call it once after
+     * init() and before any get(), the bundle is read without locking from then on */
+    void preload(const std::string& root, size_t max_bytes);
+
+    // return 0 and the entry of a readable regular file, or the errno of stat/open/mmap
+    int get(const char* path, File_ref& entry);
+    void invalidate(const std::string& path);
+
+    int inotify_fd() const {return m_inotifyfd;}
+    void handle_inotify();
+
+private:
+    File_cache();
+    ~File_cache();
+
+    void watch(const std::string& dir);
+
+    // the events were lost: nothing cached can be trusted any more
+    void invalidate_all();
+    int load(const char* path, File_ref& entry);
+    void describe(File_entry& entry);
+    void collect(const std::string& dir, std::vector<File_ref>& files, size_t& bytes, size_t max_bytes);
+
+    struct Shard
+    {
+        Locker locker;
+        std::list<File_ref> lru; // most recently used at the front
+        std::unordered_map<std::string, std::list<File_ref>::iterator> map;
+        size_t bytes;
+        int fds; // entries holding an fd
+        unsigned generation; // bumped by invalidate(), so a load racing with it isn't cached
+    };
+
+    Shard& shard(const std::string& path);
+
+    static const int SHARDS = 16;
+
+    Shard m_shards[SHARDS];
+    size_t m_shard_bytes; // bound of each shard
+    int m_shard_fds;
+    size_t m_map_limit;
+
+    std::string m_root;
+    int m_inotifyfd;
+    std::unordered_map<int, std::string> m_watches; // watch descriptor -> directory
+
+    // the entries packed by preload() and the memfd mapping holding their content
+    std::unordered_map<std::string, File_ref> m_bundle;
+    char* m_bundle_address;
+    size_t m_bundle_size;
+};
+
+#endif
@@ -1,40 +1,122 @@
 #include "http_conn.h"
 
 const char* ok_200_title = "OK";
+const char* partial_206_title = "Partial Content";
+const char* not_modified_304_title = "Not Modified";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satify.\n";
 const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
 const char* error_404_title  = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* error_416_title = "Range Not Satisfiable";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+const char* error_501_title = "Not Implemented";
+const char* error_501_form = "The request has a transfer coding this server does not support.\n";
 
 const char* doc_root = "/home/tlcui/toyserver/root";
-
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+const char* user_snapshot = nullptr;
+
+// separates the parts of a multipart/byteranges body
+const char* range_boundary = "toyserver-5f3a9c17e2b40d86";
+
+std::atomic<int> http_conn::m_user_count(0);
+time_t http_conn::m_header_timeout = 10000;
+time_t http_conn::m_body_timeout = 30000;
+time_t http_conn::m_idle_timeout = 15000;
+time_t http_conn::m_write_timeout = 15000;
+size_t http_conn::m_sendfile_threshold = 128 << 10;
+size_t http_conn::m_buffer_limit = 64 << 10;
 db_conn_pool* http_conn::m_connpool = db_conn_pool::get_instance();
-std::unordered_map<std::string, std::string> http_conn::user_info = {};
+Db_executor* http_conn::m_db = nullptr;
+User_store http_conn::user_info;
 
-void init_user_info()
+/* stream the user table into user_info row by row, the result set is never buffered
+ * whole on the client. the caller has started the generation, see begin_sync(). false
+ * if mysql couldn't be reached or the stream broke, then no user is dropped */
+static bool stream_user_info()
 {
-    http_conn::m_connpool->init("localhost", "root", "123456", "toyserver", 0, 4);
     MYSQL* mysql = http_conn::m_connpool->get_connection();
-    mysql_query(mysql, "select username, password from user");
-
-    MYSQL_RES* result = mysql_store_result(mysql);
+    if(!mysql)
+    {
+        return false;
+    }
 
-    MYSQL_ROW row = mysql_fetch_row(result);
-    while(row)
+    // the estimate innodb keeps costs no scan, and saves rehashing the shards as they grow
+    if(mysql_query(mysql, "select table_rows from information_schema.tables "
+                          "where table_schema = database() and table_name = 'user'") == 0)
     {
-        std::string temp1(row[0]);
-        std::string temp2(row[1]);
-        http_conn::user_info[temp1] = temp2;
-        row = mysql_fetch_row(result);
+        MYSQL_RES* estimate = mysql_store_result(mysql);
+        if(estimate)
+        {
+            MYSQL_ROW row = mysql_fetch_row(estimate);
+            if(row && row[0])
+            {
+                http_conn::user_info.reserve(strtoull(row[0], NULL, 10));
+            }
+            mysql_free_result(estimate);
+        }
     }
 
+    bool ok = false;
+    MYSQL_RES* result = nullptr;
+    if(mysql_query(mysql, "select username, password from user") == 0)
+    {
+        result = mysql_use_result(mysql);
+    }
+    if(result)
+    {
+        MYSQL_ROW row;
+        while((row = mysql_fetch_row(result)))
+        {
+            unsigned long* lengths = mysql_fetch_lengths(result);
+            http_conn::user_info.sync(row[0], lengths[0], row[1], lengths[1]);
+        }
+        // a null row is also how a broken stream ends
+        ok = mysql_errno(mysql) == 0;
+        mysql_free_result(result);
+    }
     http_conn::m_connpool->release_connection(mysql);
+
+    if(ok)
+    {
+        http_conn::user_info.end_sync();
+    }
+    return ok;
+}
+
+bool init_user_info()
+{
+    http_conn::m_connpool->init("localhost", "root", "123456", "toyserver", 0, 2, 8);
+
+    if(user_snapshot && http_conn::user_info.load(user_snapshot, sysconf(_SC_NPROCESSORS_ONLN)))
+    {
+        /* the users loaded are of the old generation, the ones registered once the
+         * listener opens of the new one, so the sync in the background never drops them */
+        http_conn::user_info.begin_sync();
+        return true;
+    }
+
+    http_conn::user_info.begin_sync();
+    if(!stream_user_info())
+    {
+        fprintf(stderr, "no connection to mysql, starting without the users\n");
+    }
+    else if(user_snapshot)
+    {
+        http_conn::user_info.save(user_snapshot);
+    }
+    return false;
+}
+
+void* sync_user_info(void* arg)
+{
+    if(stream_user_info() && user_snapshot)
+    {
+        http_conn::user_info.save(user_snapshot);
+    }
+    return arg;
 }
 
 int set_nonblocking(int fd)
@@ -45,7 +127,7 @@ int set_nonblocking(int fd)
     return old_option;
 }
 
-void addfd(int epollfd, int fd, bool one_shot)
+void addfd(int epollfd, int fd, bool one_shot, bool nonblock)
 {
     epoll_event event;
     event.data.fd = fd;
@@ -55,7 +137,10 @@ void addfd(int epollfd, int fd, bool one_shot)
         event.events |= EPOLLONESHOT;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    set_nonblocking(fd);
+    if(nonblock)
+    {
+        set_nonblocking(fd);
+    }
 }
 
 void removefd(int epollfd, int fd)
@@ -77,24 +162,44 @@ void http_conn::close_conn(bool real_close)
 {
     if(real_close && (m_sockfd!=-1))
     {
-        removefd(m_epollfd, m_sockfd);
+        unmap();
+        m_read_buf.release();
+        m_write_buf.release();
+        // the io_uring reactor closes the fd itself, once its pending operations are cancelled
+        if(!m_handback)
+        {
+            removefd(m_epollfd, m_sockfd);
+        }
         m_sockfd  = -1;
         m_user_count--;
     }
 }
 
-void http_conn::init(int sockfd, const sockaddr_in& addr)
+void http_conn::init(int sockfd, const sockaddr_in& addr, int epollfd, Handback* handback)
 {
     m_sockfd = sockfd;
     m_address = addr;
-    addfd(m_epollfd, sockfd, true);
-    
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    
+    m_epollfd = epollfd;
+    m_handback = handback;
+    m_timer.user = this;
+    ++m_generation;
+
+    // the socket comes from accept4(SOCK_NONBLOCK), so no more fcntl here
+    if(!m_handback)
+    {
+        addfd(m_epollfd, sockfd, true, false);
+    }
+
     m_user_count++;
+    m_busy = false;
 
+    m_read_idx = 0;
+    m_checked_idx = 0;
     init();
+
+    // the header phase of the first request starts right at the accept
+    m_idle = false;
+    m_deadline = now_ms() + m_header_timeout;
 }
 
 void http_conn::init()
@@ -107,29 +212,59 @@ void http_conn::init()
     m_content_length = 0;
     m_host = 0;
     m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
     m_write_idx = 0;
     cgi = 0;
+    m_file_address = 0;
+    m_sendfile = false;
+    m_file_offset = 0;
+    m_gzip = false;
+    m_range_count = 0;
+    m_iv_count = 0;
+    m_iv_first = 0;
     bytes_to_send = 0;
     bytes_have_send = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
-}
 
-// read all the data from client, until there's nothing to read or client disconnects
-bool http_conn::read()
-{
-    if(m_read_idx >= READ_BUFFER_SIZE)
+    // keep the bytes of the pipelined requests read after the one just answered
+    int pipelined = m_read_idx - m_checked_idx;
+    if(pipelined > 0)
     {
-        return false;
+        memmove(m_read_buf.data(), m_read_buf.data() + m_checked_idx, pipelined);
     }
+    else
+    {
+        // nothing to keep, the buffers are taken again from the pool by the next request
+        pipelined = 0;
+        m_read_buf.release();
+    }
+    m_write_buf.release();
+    m_read_idx = pipelined;
+    m_checked_idx = 0;
+    m_request.clear(m_read_buf.data());
 
+    // the header phase of a pipelined request has already begun
+    m_pipelined = (pipelined > 0);
+    m_idle = (pipelined == 0);
+    m_deadline = now_ms() + (m_idle ? m_idle_timeout : m_header_timeout);
+}
+
+/* read all the data from client, until there's nothing to read or client disconnects.
+ * a short read means the socket buffer is drained, so we stop there instead of paying
+ * one more recv for the EAGAIN: the EPOLLONESHOT re-arm in modfd() checks readiness
+ * again, so bytes arriving in between still wake the reactor */
+bool http_conn::read()
+{
     int bytes_read = 0;
+    bool got = false;
     while(1)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx,  READ_BUFFER_SIZE - m_read_idx, 0);
+        // a full buffer grows, up to m_buffer_limit
+        if(m_read_idx >= (int)m_read_buf.size() && !grow_read_buf())
+        {
+            return got;
+        }
+
+        int space = m_read_buf.size() - m_read_idx;
+        bytes_read = recv(m_sockfd, m_read_buf.data() + m_read_idx, space, 0);
         if(bytes_read == -1)
         {
             if(errno == EAGAIN || errno == EWOULDBLOCK) // read complete 
@@ -144,18 +279,91 @@ bool http_conn::read()
         }
 
         m_read_idx += bytes_read;
+        got = true;
+
+        // the first byte of a keep-alive request starts its header phase
+        if(m_idle)
+        {
+            m_idle = false;
+            m_deadline = now_ms() + m_header_timeout;
+        }
+
+        if(bytes_read < space)
+        {
+            break;
+        }
     }
     return true;
 }
 
+bool http_conn::received(const char* data, size_t len)
+{
+    while(len > 0)
+    {
+        if(m_read_idx >= (int)m_read_buf.size() && !grow_read_buf())
+        {
+            return false;
+        }
+        size_t space = m_read_buf.size() - m_read_idx;
+        size_t n = len < space ? len : space;
+        memcpy(m_read_buf.data() + m_read_idx, data, n);
+        m_read_idx += n;
+        data += n;
+        len -= n;
+    }
+
+    // the first byte of a keep-alive request starts its header phase
+    if(m_idle)
+    {
+        m_idle = false;
+        m_deadline = now_ms() + m_header_timeout;
+    }
+    return true;
+}
+
+/* the parsed part of the request points into the read buffer,
+ * so whatever was set before the move follows it */
+bool http_conn::grow_read_buf()
+{
+    size_t need = m_read_buf.size() ? m_read_buf.size() + 1 : READ_BUFFER_SIZE;
+    const char* old = m_read_buf.data();
+    size_t old_size = m_read_buf.size();
+    if(!m_read_buf.reserve(need, m_read_idx, m_buffer_limit))
+    {
+        return false;
+    }
+
+    char* data = m_read_buf.data();
+    auto follow = [&](const char* p) -> const char*
+    {
+        if(p && old && p >= old && p < old + old_size)
+        {
+            return data + (p - old);
+        }
+        return p;
+    };
+    m_url = follow(m_url);
+    m_version = const_cast<char*>(follow(m_version));
+    m_host = const_cast<char*>(follow(m_host));
+    m_request.rebase(data);
+    return true;
+}
+
 // vice state machine
 http_conn::LINE_STATUS http_conn::parse_line()
 {
     char temp;
     for(; m_checked_idx < m_read_idx; ++m_checked_idx)
     {
+        // jump straight to the next '\r' or '\n', see scan.h
+        m_checked_idx = find_eol(m_read_buf.data() + m_checked_idx, m_read_buf.data() + m_read_idx) - m_read_buf.data();
+        if(m_checked_idx == m_read_idx)
+        {
+            break;
+        }
+
         // temp is the char to be parsed 
-        temp = m_read_buf[m_checked_idx];
+        temp = m_read_buf.data()[m_checked_idx];
         
         // if temp=='\r', then it might be end of a line(it depends on the next char)
         if(temp == '\r')
@@ -166,10 +374,10 @@ http_conn::LINE_STATUS http_conn::parse_line()
                 return LINE_OPEN;
             }
             // come across end of line 
-            else if(m_read_buf[m_checked_idx+1] == '\n')
+            else if(m_read_buf.data()[m_checked_idx+1] == '\n')
             {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                m_read_buf.data()[m_checked_idx++] = '\0';
+                m_read_buf.data()[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
@@ -178,10 +386,10 @@ http_conn::LINE_STATUS http_conn::parse_line()
         // if temp=='\n', then it also might be the end of a line 
         else if(temp == '\n')
         {
-            if((m_checked_idx > 1) && (m_read_buf[m_checked_idx-1] = '\0'))
+            if((m_checked_idx > 1) && (m_read_buf.data()[m_checked_idx-1] = '\0'))
             {
-                m_read_buf[m_checked_idx-1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                m_read_buf.data()[m_checked_idx-1] = '\0';
+                m_read_buf.data()[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
@@ -194,17 +402,17 @@ http_conn::LINE_STATUS http_conn::parse_line()
 http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
 {
     // figure out and return the first position of '\t' or ' ' in the request line 
-    m_url = strpbrk(text, " \t");
+    char* url = strpbrk(text, " \t");
 
     // if there is no '\t' or ' ', then http syntax is wrong
-    if(!m_url)
+    if(!url)
     {
         //printf("---bad request, line 198, http_conn.cpp---\n");
         return BAD_REQUEST;
     }
 
     // replace this position with '\0' to obtain the string in front of it 
-    *m_url++ = '\0';
+    *url++ = '\0';
 
     // obtain the string
     char* method = text;
@@ -219,6 +427,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
         m_method = POST;
         cgi = 1;
     }
+    else if(strcasecmp(method, "HEAD") == 0)
+    {
+        m_method = HEAD;
+    }
     else
     {
         //printf("---bad request, line 220, http_conn.cpp---\n");
@@ -226,9 +438,9 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
     }
 
     // skip the following ' ' and '\t'
-    m_url += strspn(m_url, " \t");
+    url += strspn(url, " \t");
     
-    m_version = strpbrk(m_url, " \t");
+    m_version = strpbrk(url, " \t");
     if(!m_version)
     {
         //printf("---bad request, line 230, http_conn.cpp---\n");
@@ -246,30 +458,32 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
     }
     
     // skip "http://" if it exists
-    if(strncasecmp(m_url, "http://", 7) == 0)
+    if(strncasecmp(url, "http://", 7) == 0)
     {
-        m_url += 7;
+        url += 7;
 
         // skip the address and find out the path of the file requested
-        m_url = strchr(m_url, '/');
+        url = strchr(url, '/');
     }
 
-    if(strncasecmp(m_url, "https://", 8) == 0)
+    if(strncasecmp(url, "https://", 8) == 0)
     {
-        m_url += 8;
-        m_url = strchr(m_url, '/');
+        url += 8;
+        url = strchr(url, '/');
     }
 
-    if(!m_url || m_url[0] != '/')
+    if(!url || url[0] != '/')
     {
         //printf("---bad request, line 261, http_conn.cpp---\n");
         return BAD_REQUEST;
     }
 
-    // in this case the request is a GET(m_url is /), getting index.html.
-    if(strlen(m_url) == 1)
+    // in this case the request is a GET(url is /), getting index.html.
+    m_url = url;
+    if(strlen(url) == 1)
     {
-        strcat(m_url, "index.html");
+        // never write past the request line, the next pipelined request may follow it
+        m_url = "/index.html";
     }
     //printf("-----the client is looking for %s\n", m_url);
     m_check_state = CHECK_STATE_HEADER;
@@ -286,6 +500,7 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         {
             // it is a POST, so we need to jump to parse the content 
             m_check_state = CHECK_STATE_CONTENT;
+            m_deadline = now_ms() + m_body_timeout;
             return NO_REQUEST;
         }
 
@@ -294,34 +509,71 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         return GET_REQUEST;
     }
     
-    // still headers 
-    else if(strncasecmp(text, "Connection:", 11) == 0)
+    // still headers, split the line at the colon ending the name
+    char* end = text + strlen(text);
+    char* colon = const_cast<char*>(find_char(text, end, ':'));
+    if(colon == end)
     {
-        text += 11;
-        
-        //ski; all the ' ' and '\t'
-        text += strspn(text, " \t");
-
-        if(strcasecmp(text, "keep-alive") == 0)
-        {
-            m_linger = true;
-        }
+        //printf("malformed header: %s\n", text);
+        return NO_REQUEST;
     }
-    else if(strncasecmp(text, "Content-Length:", 15) == 0)
+
+    //skip all the ' ' and '\t' around the value
+    char* value = colon + 1;
+    value += strspn(value, " \t");
+    while(end > value && (end[-1] == ' ' || end[-1] == '\t'))
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atoi(text);
+        *--end = '\0';
     }
-    else if(strncasecmp(text, "Host:", 5) == 0)
+
+    // record every header, and act upon the ones we know right away
+    Http_request::HEADER id;
+    if(!m_request.add(text, colon - text, value, end - value, id))
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        return BAD_REQUEST;
     }
-    else
+
+    switch(id)
     {
-        //printf("unknown header: %s\n", text);
+        case Http_request::CONNECTION:
+            {
+                if(strcasecmp(value, "keep-alive") == 0)
+                {
+                    m_linger = true;
+                }
+                break;
+            }
+        case Http_request::CONTENT_LENGTH:
+            {
+                /* the body is skipped by its length to find the next pipelined request, so
+                 * only plain digits within the buffer limit are taken */
+                char* digits_end;
+                errno = 0;
+                long len = strtol(value, &digits_end, 10);
+                if(value[0] < '0' || value[0] > '9' || *digits_end != '\0' || errno == ERANGE
+                   || (size_t)len > m_buffer_limit)
+                {
+                    return BAD_REQUEST;
+                }
+                m_content_length = len;
+                break;
+            }
+        case Http_request::HOST:
+            {
+                m_host = value;
+                break;
+            }
+        case Http_request::TRANSFER_ENCODING:
+            {
+                /* no transfer coding is decoded, so the end of the body is unknown. a proxy in
+                 * front would frame the next request differently, see RFC 7230 3.3.3 */
+                return NOT_IMPLEMENTED;
+            }
+        default:
+            {
+                //printf("header kept for later: %s\n", text);
+                break;
+            }
     }
     return NO_REQUEST;
 }
@@ -331,8 +583,9 @@ http_conn::HTTP_CODE http_conn::parse_content(char* text)
     // whether we read all the content 
     if(m_read_idx >= m_content_length + m_checked_idx)
     {
-        text[m_content_length] = '\0';
+        // the body is not '\0' terminated, the next pipelined request may start right after it
         m_string = text;
+        m_checked_idx += m_content_length;
         return GET_REQUEST;
     }
 
@@ -369,9 +622,9 @@ http_conn::HTTP_CODE http_conn::process_read()
             case CHECK_STATE_HEADER:
                 {
                     ret = parse_headers(text);
-                    if(ret == BAD_REQUEST)
+                    if(ret == BAD_REQUEST || ret == NOT_IMPLEMENTED)
                     {
-                        return BAD_REQUEST;
+                        return ret;
                     }
                     else if(ret == GET_REQUEST)
                     {
@@ -402,12 +655,33 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
+// true if an Accept-Encoding value takes gzip, that is names it or '*' without q=0
+static bool accepts_gzip(const char* value)
+{
+    if(!value)
+    {
+        return false;
+    }
+    while(*value)
+    {
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, " \t,;");
+        bool gzip = (len == 4 && strncasecmp(value, "gzip", 4) == 0)
+                    || (len == 6 && strncasecmp(value, "x-gzip", 6) == 0)
+                    || (len == 1 && *value == '*');
+        const char* end = value + strcspn(value, ",");
+        const char* q = static_cast<const char*>(memmem(value + len, end - value - len, "q=", 2));
+        if(gzip)
+        {
+            return !q || strtod(q + 2, nullptr) > 0;
+        }
+        value = end;
+    }
+    return false;
+}
+
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    // initialize m_real_file
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    
     // find '/' in m_url
     const char *p = strrchr(m_url, '/');
     if(cgi==1 && ( *(p+1) == '2' || *(p+1) == '3' ) )
@@ -415,116 +689,281 @@ http_conn::HTTP_CODE http_conn::do_request()
        char flag = *(p+1);
        // the content looks like "user=123&password=123"
        char user[100], password_b[100];
-       int i;
-       for(i = 5; m_string[i] != '&'; ++i)
-       {
-            user[i-5] = m_string[i];
-       }
-       user[i-5] = '\0';
-       int j=0;
-       for(i = i + 10; m_string[i] != '\0'; ++i, ++j)
+       const char* end = m_string + m_content_length;
+       const char* amp = static_cast<const char*>(memchr(m_string, '&', m_content_length));
+       if(!amp || amp - m_string < 5 || amp - m_string - 5 >= 100 || end - amp < 10 || end - amp - 10 >= 100)
        {
-            password_b[j] = m_string[i];
+           return BAD_REQUEST;
        }
-       password_b[j] = '\0';
+       memcpy(user, m_string + 5, amp - m_string - 5);
+       user[amp - m_string - 5] = '\0';
+       memcpy(password_b, amp + 10, end - amp - 10);
+       password_b[end - amp - 10] = '\0';
        if(flag == '3') //register
        {
-            char* sql = new char[200];
-            strcpy(sql, "insert into user(username, password) values(");
-            strcat(sql, "'");
-            strcat(sql, user);
-            strcat(sql, "', '");
-            strcat(sql, password_b);
-            strcat(sql, "')");
-            if(user_info.count(user)) // user name already exists
+            // taking the name is atomic, so of two concurrent registrations only one gets it
+            if(!user_info.insert(user, password_b)) // user name already exists
             {
-                strcpy(m_url, "/registerError.html");
+                m_url = "/registerError.html";
             }
             else
             {
-                lock.lock();
-                MYSQL* mysql = m_connpool->get_connection();
-                user_info[user] = password_b;
-                mysql_query(mysql, sql);
-                m_connpool->release_connection(mysql);
-                lock.unlock();
-                strcpy(m_url, "/log.html");
+                /* the user can log in right away, its row is written behind in the next
+                 * batch, and the response is completed once that batch is committed */
+                std::string username(user);
+                m_db->insert_user(username, password_b, [this, username](bool ok) {complete_register(username, ok);});
+                return PENDING_REQUEST;
             }
-            delete [] sql;
        }
         else if(flag == '2') // log in
         {
-            if(user_info.count(user) && user_info[user] == password_b)
+            if(user_info.check(user, password_b))
             {
-                strcpy(m_url, "/welcome.html");
+                m_url = "/welcome.html";
             }
             else
             {
-                strcpy(m_url, "/logError.html");
+                m_url = "/logError.html";
             }
         }
     }
 
+    return do_file();
+}
+
+// look up the file of m_url, for the page of a request or the result of a form
+http_conn::HTTP_CODE http_conn::do_file()
+{
+    const char* p = strrchr(m_url, '/');
+    const char* url_real = m_url;
     if(*(p+1) == '0')
     {
-        char* m_url_real = new char[200];
-        strcpy(m_url_real, "/register.html");
-
-        // get the complete path of register.html
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        delete [] m_url_real;
+        url_real = "/register.html";
     }
-    
     else if(*(p+1) == '1')
     {
-        char* m_url_real = new char[200];
-        strcpy(m_url_real, "/log.html");
-
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        delete [] m_url_real;
+        url_real = "/log.html";
     }
 
-    // it is not register nor login 
-    else
+    // get the complete path, always '\0' terminated, so m_real_file needs no clearing
+    snprintf(m_real_file, FILENAME_LEN, "%s%s", doc_root, url_real);
+
+    // stat, open and mmap only happen on a miss of the cache
+    int err = File_cache::get_instance()->get(m_real_file, m_file);
+    if(err == EACCES) // if not readable
     {
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+        return FORBIDDEN_REQUEST;
     }
-
-    if(stat(m_real_file, &m_file_stat) < 0) // file doesn't exist 
+    if(err == EISDIR) // if it's a directory
     {
-        return NO_REQUEST;
+        return BAD_REQUEST;
+    }
+    if(err != 0) // file doesn't exist 
+    {
+        return NO_RESOURCE;
     }
 
-    if(!(m_file_stat.st_mode & S_IROTH)) // if not readable
+    m_file_stat = m_file->st;
+    m_file_address = m_file->address;
+
+    // the gzip variant if the client takes it, ranges are only served from the identity one
+    if(!m_file->gzip.empty() && !m_request.has(Http_request::RANGE)
+       && accepts_gzip(m_request.value(Http_request::ACCEPT_ENCODING)))
     {
-        return FORBIDDEN_REQUEST;
+        m_gzip = true;
+        m_file_address = const_cast<char*>(m_file->gzip.data());
+        m_file_stat.st_size = m_file->gzip.size();
     }
 
-    if(S_ISDIR(m_file_stat.st_mode)) // if it's a directory
+    // the client already has this version of the file
+    if(m_method != POST && not_modified())
     {
-        return BAD_REQUEST;
+        return NOT_MODIFIED;
     }
 
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = static_cast<char*>(mmap(NULL, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
-    
-    close(fd);
+    if(m_method == GET && !cgi)
+    {
+        return parse_range();
+    }
     //printf("---do_request returning FILE_REQUEST---\n");
     return FILE_REQUEST;
 }
 
-void http_conn::unmap()
+// true if the entity tag is one of the comma separated list, weak comparison
+static bool etag_matches(const char* list, const std::string& etag)
+{
+    while(*list)
+    {
+        list += strspn(list, " \t,");
+        if(*list == '*')
+        {
+            return true;
+        }
+        if(strncmp(list, "W/", 2) == 0)
+        {
+            list += 2;
+        }
+        size_t len = strcspn(list, " \t,");
+        if(len == etag.size() && strncmp(list, etag.c_str(), len) == 0)
+        {
+            return true;
+        }
+        list += len;
+    }
+    return false;
+}
+
+// If-None-Match takes precedence over If-Modified-Since, see RFC 7232
+bool http_conn::not_modified() const
+{
+    const char* none_match = m_request.value(Http_request::IF_NONE_MATCH);
+    if(none_match)
+    {
+        return etag_matches(none_match, etag());
+    }
+
+    const char* modified_since = m_request.value(Http_request::IF_MODIFIED_SINCE);
+    if(modified_since)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if(strptime(modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+        {
+            return m_file_stat.st_mtime <= timegm(&tm);
+        }
+    }
+    return false;
+}
+
+/* If-Range asks for the ranges only if the file is still the same version,
+ * compared strongly to the ETag, or exactly to the Last-Modified date */
+bool http_conn::if_range_matches() const
+{
+    const char* if_range = m_request.value(Http_request::IF_RANGE);
+    if(!if_range)
+    {
+        return true;
+    }
+    if(if_range[0] == '"')
+    {
+        return etag() == if_range;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    return strptime(if_range, "%a, %d %b %Y %H:%M:%S GMT", &tm) && timegm(&tm) == m_file_stat.st_mtime;
+}
+
+// digits at p into value, false if there is none or too many
+static bool parse_offset(const char*& p, off_t& value)
+{
+    if(*p < '0' || *p > '9')
+    {
+        return false;
+    }
+    value = 0;
+    for(; *p >= '0' && *p <= '9'; ++p)
+    {
+        if(value > (INT64_MAX - 9) / 10)
+        {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    return true;
+}
+
+/* fill m_ranges from "Range: bytes=first-last, first-, -suffix, ...". a header we
+ * can't parse, or with more than MAX_RANGES ranges, is ignored and the whole file is
+ * sent, as RFC 7233 allows. ranges starting past the end of the file are dropped */
+http_conn::HTTP_CODE http_conn::parse_range()
 {
-    if(m_file_address)
+    const char* p = m_request.value(Http_request::RANGE);
+    off_t size = m_file_stat.st_size;
+    if(!p || size == 0 || strncasecmp(p, "bytes=", 6) != 0 || !if_range_matches())
+    {
+        return FILE_REQUEST;
+    }
+    p += 6;
+
+    int count = 0;
+    while(true)
+    {
+        p += strspn(p, " \t");
+        off_t first, last;
+        bool satisfiable = true;
+        if(*p == '-') // the last bytes of the file
+        {
+            ++p;
+            off_t suffix;
+            if(!parse_offset(p, suffix))
+            {
+                return FILE_REQUEST;
+            }
+            satisfiable = suffix > 0;
+            first = suffix < size ? size - suffix : 0;
+            last = size - 1;
+        }
+        else
+        {
+            if(!parse_offset(p, first) || *p++ != '-')
+            {
+                return FILE_REQUEST;
+            }
+            last = size - 1;
+            if(*p >= '0' && *p <= '9')
+            {
+                if(!parse_offset(p, last) || last < first)
+                {
+                    return FILE_REQUEST;
+                }
+                last = last < size ? last : size - 1;
+            }
+            satisfiable = first < size;
+        }
+
+        if(satisfiable)
+        {
+            if(count == MAX_RANGES)
+            {
+                return FILE_REQUEST;
+            }
+            m_ranges[count].first = first;
+            m_ranges[count].last = last;
+            ++count;
+        }
+
+        p += strspn(p, " \t");
+        if(*p == '\0')
+        {
+            break;
+        }
+        if(*p++ != ',')
+        {
+            return FILE_REQUEST;
+        }
+    }
+
+    if(count == 0)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        return RANGE_NOT_SATISFIABLE;
     }
+
+    // sendfile takes a single range, a file too large to be mapped gets only one part
+    m_range_count = (count > 1 && !m_file_address) ? 0 : count;
+    return FILE_REQUEST;
+}
+
+// drop our reference to the cached file, the cache unmaps it once nobody uses it
+void http_conn::unmap()
+{
+    m_file.reset();
+    m_file_address = 0;
 }
 
 bool http_conn::add_response(const char* format, ...)
 {
-    if(m_write_idx > WRITE_BUFFER_SIZE)
+    if(!m_write_buf.reserve(WRITE_BUFFER_SIZE, m_write_idx, m_buffer_limit))
     {
         return false;
     }
@@ -533,48 +972,177 @@ bool http_conn::add_response(const char* format, ...)
     va_start(arg_list, format);
 
     // write data(format) into m_write_buf, return the length of data written
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx,
-                        format, arg_list);
-    
-    if(len >= WRITE_BUFFER_SIZE- 1 - m_write_idx)
+    va_list again;
+    va_copy(again, arg_list);
+    int space = m_write_buf.size() - m_write_idx;
+    int len = vsnprintf(m_write_buf.data() + m_write_idx, space, format, arg_list);
+
+    // too long for the room left, grow the buffer and format once more
+    if(len >= space)
     {
-        va_end(arg_list);
-        return false;
+        if(len < 0 || !m_write_buf.reserve(m_write_idx + len + 1, m_write_idx, m_buffer_limit))
+        {
+            va_end(again);
+            va_end(arg_list);
+            return false;
+        }
+        vsnprintf(m_write_buf.data() + m_write_idx, len + 1, format, again);
     }
 
     m_write_idx += len;
+    va_end(again);
     va_end(arg_list);
     return true;
 }
 
+// copy bytes which need no formatting, the fast path of the header builders below
+bool http_conn::add_bytes(const char* data, int len)
+{
+    if(!m_write_buf.reserve(m_write_idx + len, m_write_idx, m_buffer_limit))
+    {
+        return false;
+    }
+    memcpy(m_write_buf.data() + m_write_idx, data, len);
+    m_write_idx += len;
+    return true;
+}
+
 bool http_conn::add_status_line(int status, const char* title)
 {
+    Http_response::Fragment line = Http_response::status_line(status);
+    if(line.len)
+    {
+        return add_fragment(line);
+    }
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(off_t content_len)
 {
-    return add_response("Content-Length: %d\r\n", content_len);
+    char line[48] = "Content-Length: ";
+    int len = 16;
+    len += Http_response::format_uint(line + len, content_len);
+    line[len++] = '\r';
+    line[len++] = '\n';
+    return add_bytes(line, len);
 }
 
 bool http_conn::add_linger()
 {
-    return add_response("Connection: %s\r\n", m_linger ? "keep-alive" : "close");
+    return add_fragment(Http_response::connection(m_linger));
+}
+
+bool http_conn::add_date()
+{
+    return add_fragment(Http_response::date_server());
 }
 
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return add_bytes("\r\n", 2);
 }
 
+// a response to HEAD only has the headers of the body it would have
 bool http_conn::add_content(const char* content)
 {
-    return add_response("%s", content);
+    if(m_method == HEAD)
+    {
+        return true;
+    }
+    return add_bytes(content, strlen(content));
 }
 
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(off_t content_len)
 {
-    return add_content_length(content_len) && add_linger() && add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_date() && add_blank_line();
+}
+
+/* 206 for the ranges in m_ranges, the status line is already there. a single range is
+ * the body itself, several make a multipart/byteranges body whose part headers follow
+ * the response headers in m_write_buf, and are pointed at by the iovecs in between
+ * the slices of the file */
+bool http_conn::add_ranges()
+{
+    off_t size = m_file_stat.st_size;
+    if(m_range_count == 1)
+    {
+        const Range& range = m_ranges[0];
+        off_t len = range.last - range.first + 1;
+        if(!(add_response("Content-Range: bytes %ld-%ld/%ld\r\n", (long)range.first, (long)range.last, (long)size)
+             && add_headers(len)))
+        {
+            return false;
+        }
+
+        m_iv[0].iov_base = m_write_buf.data();
+        m_iv[0].iov_len = m_write_idx;
+        m_iv_count = 1;
+        if(m_file_address)
+        {
+            m_iv[1].iov_base = m_file_address + range.first;
+            m_iv[1].iov_len = len;
+            m_iv_count = 2;
+        }
+        else
+        {
+            m_sendfile = true;
+            m_file_offset = range.first;
+        }
+        bytes_to_send = m_write_idx + len;
+        return true;
+    }
+
+    char parts[MAX_RANGES][128];
+    int part_len[MAX_RANGES];
+    off_t body = 0;
+    for(int i = 0; i < m_range_count; i++)
+    {
+        part_len[i] = snprintf(parts[i], sizeof(parts[i]), "\r\n--%s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                               range_boundary, (long)m_ranges[i].first, (long)m_ranges[i].last, (long)size);
+        body += part_len[i] + m_ranges[i].last - m_ranges[i].first + 1;
+    }
+    char tail[64];
+    int tail_len = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", range_boundary);
+    body += tail_len;
+
+    if(!(add_response("Content-Type: multipart/byteranges; boundary=%s\r\n", range_boundary) && add_headers(body)))
+    {
+        return false;
+    }
+
+    int header_len = m_write_idx;
+    int part_offset[MAX_RANGES];
+    for(int i = 0; i < m_range_count; i++)
+    {
+        part_offset[i] = m_write_idx;
+        if(!add_bytes(parts[i], part_len[i]))
+        {
+            return false;
+        }
+    }
+    int tail_offset = m_write_idx;
+    if(!add_bytes(tail, tail_len))
+    {
+        return false;
+    }
+
+    // m_write_buf won't grow anymore, so the iovecs may point into it
+    char* buf = m_write_buf.data();
+    int n = 0;
+    m_iv[n].iov_base = buf;
+    m_iv[n++].iov_len = header_len;
+    for(int i = 0; i < m_range_count; i++)
+    {
+        m_iv[n].iov_base = buf + part_offset[i];
+        m_iv[n++].iov_len = part_len[i];
+        m_iv[n].iov_base = m_file_address + m_ranges[i].first;
+        m_iv[n++].iov_len = m_ranges[i].last - m_ranges[i].first + 1;
+    }
+    m_iv[n].iov_base = buf + tail_offset;
+    m_iv[n++].iov_len = tail_len;
+    m_iv_count = n;
+    bytes_to_send = header_len + body;
+    return true;
 }
 
 // prepare the http-response
@@ -584,6 +1152,7 @@ bool http_conn::process_write(HTTP_CODE ret)
     {
         case INTERNAL_ERROR:
             {
+                m_linger = false;
                 add_status_line(500, error_500_title);
                 add_headers(strlen(error_500_form));
                 if(!add_content(error_500_form))
@@ -593,8 +1162,14 @@ bool http_conn::process_write(HTTP_CODE ret)
                 break;
             }
 
+        case NO_RESOURCE:
         case BAD_REQUEST:
             {
+                // we can't tell where the next pipelined request would start
+                if(ret == BAD_REQUEST)
+                {
+                    m_linger = false;
+                }
                 add_status_line(404, error_404_title);
                 add_headers(strlen(error_404_form));
                 if(!add_content(error_404_form))
@@ -604,6 +1179,19 @@ bool http_conn::process_write(HTTP_CODE ret)
                 break;
             }
 
+        case NOT_IMPLEMENTED:
+            {
+                // the body which follows can't be skipped, so the connection ends here
+                m_linger = false;
+                add_status_line(501, error_501_title);
+                add_headers(strlen(error_501_form));
+                if(!add_content(error_501_form))
+                {
+                    return false;
+                }
+                break;
+            }
+
         case FORBIDDEN_REQUEST:
             {
                 add_status_line(403, error_403_title);
@@ -615,15 +1203,62 @@ bool http_conn::process_write(HTTP_CODE ret)
                 break;
             }
             
+        case NOT_MODIFIED:
+            {
+                // no body, so no Content-Length either
+                if(!(add_status_line(304, not_modified_304_title) && add_bytes(entity_headers().data(), entity_headers().size())
+                     && add_linger() && add_date() && add_blank_line()))
+                {
+                    return false;
+                }
+                break;
+            }
+
+        case RANGE_NOT_SATISFIABLE:
+            {
+                if(!(add_status_line(416, error_416_title)
+                     && add_response("Content-Range: bytes */%ld\r\n", (long)m_file_stat.st_size) && add_headers(0)))
+                {
+                    return false;
+                }
+                break;
+            }
+
         case FILE_REQUEST:
             {
+                if(m_range_count)
+                {
+                    return add_status_line(206, partial_206_title)
+                           && add_bytes(entity_headers().data(), entity_headers().size()) && add_ranges();
+                }
+
                 add_status_line(200, ok_200_title);
-                if(m_file_stat.st_size)
+                add_bytes(entity_headers().data(), entity_headers().size());
+                if(m_method == HEAD)
+                {
+                    // the length of the body, which is neither mapped into the iovecs nor sent
+                    add_headers(m_file_stat.st_size);
+                    break;
+                }
+                else if(m_file_stat.st_size && !m_file_address)
+                {
+                    // too large to be mapped by the cache, see write() for the sendfile path
+                    add_headers(m_file_stat.st_size);
+                    m_iv[0].iov_base = m_write_buf.data();
+                    m_iv[0].iov_len = m_write_idx;
+                    m_iv_count = 1;
+
+                    m_sendfile = true;
+                    m_file_offset = 0;
+                    bytes_to_send = m_write_idx + m_file_stat.st_size;
+                    return true;
+                }
+                else if(m_file_stat.st_size)
                 {
                     add_headers(m_file_stat.st_size);
 
                     // let m_write_buf be the first memory area 
-                    m_iv[0].iov_base = m_write_buf;
+                    m_iv[0].iov_base = m_write_buf.data();
                     m_iv[0].iov_len = m_write_idx;
 
                     // let m_file_address be the second memory area 
@@ -644,13 +1279,14 @@ bool http_conn::process_write(HTTP_CODE ret)
                         return false;
                     }
                 }
+                break;
             }
 
         default: return false;
     }
 
     // other than FILE_REQUEST, we only need one memory area to send data
-    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_base = m_write_buf.data();
     m_iv[0].iov_len = m_write_idx;
     m_iv_count =1;
     bytes_to_send = m_write_idx;
@@ -666,18 +1302,85 @@ void http_conn::process()
     // incomplete request, so we keep listening until it's ready next time 
     if(read_ret == NO_REQUEST)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        m_busy = false;
+        rearm(EPOLLIN);
         return;
     }
-    
+
+    /* the db thread answers, see complete_register(). m_busy stays set meanwhile,
+     * so the reactor neither closes the connection nor lets its timer expire */
+    if(read_ret == PENDING_REQUEST)
+    {
+        return;
+    }
+    respond(read_ret);
+}
+
+/* called on the db thread once the batch holding the user is committed. the name was
+ * taken in user_info before the insert, so a failed insert gives it back */
+void http_conn::complete_register(const std::string& username, bool ok)
+{
+    if(ok)
+    {
+        m_url = "/log.html";
+    }
+    else
+    {
+        user_info.erase(username);
+        m_url = "/registerError.html";
+    }
+    respond(do_file());
+}
+
+// prepare the response of a complete request and hand the connection back to the reactor to send it
+void http_conn::respond(HTTP_CODE read_ret)
+{
     //printf("---process_write start---\n");
     bool write_ret = process_write(read_ret);
     if(!write_ret)
     {
-        //printf("---process_write failed, close_conn()---\n");
-        close_conn();
+        /* the connection is owned by the reactor, which also has to unlink its timer,
+         * so we only shut it down here and the reactor closes it on the EPOLLHUP */
+        shutdown(m_sockfd, SHUT_RDWR);
+        m_busy = false;
+        rearm(EPOLLIN);
+        return;
+    }
+    m_deadline = now_ms() + m_write_timeout;
+    m_busy = false;
+    rearm(EPOLLOUT);
+}
+
+void http_conn::rearm(int ev)
+{
+    if(m_handback)
+    {
+        m_handback->rearm(m_sockfd, m_generation, ev);
+    }
+    else
+    {
+        modfd(m_epollfd, m_sockfd, ev);
+    }
+}
+
+// skip the iovecs sent completely and move the start of the one sent partly
+void http_conn::advance_iov(size_t sent)
+{
+    while(sent > 0 && m_iv_first < m_iv_count)
+    {
+        struct iovec& iv = m_iv[m_iv_first];
+        if(sent >= iv.iov_len)
+        {
+            sent -= iv.iov_len;
+            ++m_iv_first;
+        }
+        else
+        {
+            iv.iov_base = static_cast<char*>(iv.iov_base) + sent;
+            iv.iov_len -= sent;
+            sent = 0;
+        }
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
 }
 
 bool http_conn::write()
@@ -685,19 +1388,41 @@ bool http_conn::write()
     //printf("---main thread start write()---\n");
     //printf("---%s---\n", m_write_buf);
     //printf("---%s---\n", m_file_address);
-    int temp = 0;
+    ssize_t temp = 0;
 
     // empty http-response, usually it won't happen
     if(bytes_to_send == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
         init();
+        if(!m_pipelined)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+        }
         return true;
     }
 
     while(1)
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        if(!m_sendfile)
+        {
+            temp = writev(m_sockfd, m_iv + m_iv_first, m_iv_count - m_iv_first);
+        }
+        else if(bytes_have_send < m_write_idx)
+        {
+            // MSG_MORE holds the headers back, so they share a segment with the body
+            temp = send(m_sockfd, m_write_buf.data() + bytes_have_send, m_write_idx - bytes_have_send,
+                        MSG_MORE | MSG_NOSIGNAL);
+        }
+        else
+        {
+            // the body goes from the page cache to the socket, resuming at m_file_offset
+            temp = sendfile(m_sockfd, m_file->fd, &m_file_offset, bytes_to_send);
+            if(temp == 0) // the file has shrunk under us
+            {
+                unmap();
+                return false;
+            }
+        }
 
         if(temp < 0)
         {
@@ -713,38 +1438,46 @@ bool http_conn::write()
             return false;
         }
         
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-
-        // if data in the first memory area have been completely transmitted 
-        if(bytes_have_send >= m_iv[0].iov_len)
+        SEND_STATUS status = sent(temp);
+        if(status == SEND_CLOSE)
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            //printf("---line 744---, complete, about to close\n");
+            return false;
         }
-        else
+        else if(status == SEND_DONE)
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
-
-        if(bytes_to_send <= 0)
-        {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if(m_linger)
-            {
-                init();
-                return true;
-            }
-            else
+            /* the next pipelined request is already in m_read_buf, so the reactor
+             * hands it to the pool right away instead of re-arming EPOLLIN */
+            if(!m_pipelined)
             {
-                //printf("---line 744---, complete, about to close\n");
-                return false;
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
             }
+            return true;
         }
     }
 }
 
+http_conn::SEND_STATUS http_conn::sent(size_t n)
+{
+    bytes_have_send += n;
+    bytes_to_send -= n;
+    m_deadline = now_ms() + m_write_timeout;
+
+    if(!m_sendfile)
+    {
+        advance_iov(n);
+    }
+
+    if(bytes_to_send > 0)
+    {
+        return SEND_MORE;
+    }
+    unmap();
+    if(!m_linger)
+    {
+        return SEND_CLOSE;
+    }
+    init();
+    return SEND_DONE;
+}
+
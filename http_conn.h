@@ -17,15 +17,38 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <unordered_map>
 #include <string>
+#include <atomic>
 #include "locker.h"
 #include "db_conn_pool.h"
+#include "timer.h"
+#include "file_cache.h"
+#include "scan.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "buffer.h"
+#include "user_store.h"
+#include "db_executor.h"
+
+/* where a worker hands a connection back to its reactor once the request is done.
+ * the epoll reactor has none, the fd is re-armed in its epoll by modfd() */
+class Handback
+{
+public:
+    virtual ~Handback() {}
+    virtual void rearm(int fd, unsigned generation, int ev) = 0;
+};
 
 class http_conn
 {
+    // drives the socket i/o itself, see uring_reactor.h
+    friend class Uring_reactor;
+
 public:
     static const int FILENAME_LEN = 200;
+    // first sizes of the buffers, they grow up to m_buffer_limit
     static const int READ_BUFFER_SIZE = 2048;
     static const int WRITE_BUFFER_SIZE = 1024;
 
@@ -39,17 +62,26 @@ public:
     
     enum LINE_STATUS {LINE_OK=0, LINE_BAD, LINE_OPEN};
 
+    // progress of a response after some of its bytes were sent
+    enum SEND_STATUS {SEND_MORE, SEND_DONE, SEND_CLOSE};
+
     enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE,
                     FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR,
-                    CLOSED_CONNECTION};
+                    CLOSED_CONNECTION, NOT_MODIFIED, RANGE_NOT_SATISFIABLE,
+                    PENDING_REQUEST, NOT_IMPLEMENTED};
+
+    // byte ranges of a Range header served in one response, more are answered with the whole file
+    static const int MAX_RANGES = 8;
+    static const int MAX_IOV = 2 * MAX_RANGES + 2;
 
 public:
-    http_conn() {}
+    http_conn(): m_generation(0) {}
     ~http_conn() {}
 
 public:
-    // initialize a new accepted connection
-    void init(int sockfd, const sockaddr_in& addr);
+    /* initialize a new accepted connection, registered on the epoll of the reactor that
+     * accepted it, or handed back to handback when the reactor has no epoll */
+    void init(int sockfd, const sockaddr_in& addr, int epollfd, Handback* handback = nullptr);
 
     // close a connection
     void close_conn(bool real_close = true);
@@ -57,12 +89,36 @@ public:
     // process a client's request 
     void process();
 
+    // the insert of a registration is done, answer the request
+    void complete_register(const std::string& username, bool ok);
+
     // nonblock reading
     bool read();
 
     // nonblock writing
     bool write();
 
+    // account for n bytes of the response sent, init() for the next request once it is all out
+    SEND_STATUS sent(size_t n);
+
+    // append bytes received by the reactor, false beyond m_buffer_limit
+    bool received(const char* data, size_t len);
+
+    /* write() has finished a response, and bytes of the next request were read along
+     * with it. true once only, the caller hands the connection to the pool. never true
+     * while a response is still being sent */
+    bool take_pipelined()
+    {
+        bool pipelined = m_pipelined;
+        m_pipelined = false;
+        return pipelined;
+    }
+
+    // absolute deadline of the current phase, in the milliseconds of now_ms()
+    time_t deadline() const {return m_deadline;}
+
+    int sockfd() const {return m_sockfd;}
+
 private:  
     // initialize a new accepted connection,it will be called by init() above in public  
     void init();
@@ -72,6 +128,10 @@ private:
 
     // prepare http response
     bool process_write(HTTP_CODE ret);
+    void respond(HTTP_CODE ret);
+
+    // give the connection back to the reactor, waiting for ev
+    void rearm(int ev);
 
     /* the group of functions listed below will be called by
      * process_read() to parse http requests */
@@ -79,34 +139,77 @@ private:
     HTTP_CODE parse_headers(char* text);
     HTTP_CODE parse_content(char* text);
     HTTP_CODE do_request();
-    char* get_line () {return m_read_buf+m_start_line;}
+    HTTP_CODE do_file();
+    bool not_modified() const;
+
+    // the representation of m_file being sent, identity or gzip
+    const std::string& etag() const {return m_gzip ? m_file->gzip_etag : m_file->etag;}
+    const std::string& entity_headers() const {return m_gzip ? m_file->gzip_headers : m_file->headers;}
+    bool if_range_matches() const;
+    HTTP_CODE parse_range();
+    char* get_line () {return m_read_buf.data()+m_start_line;}
+    bool grow_read_buf();
     LINE_STATUS parse_line();
 
     /* the group of functions listed below will be called by
      * process_write() to givve http responses */
     void unmap();
     bool add_response(const char* format, ...);
+    bool add_bytes(const char* data, int len);
+    bool add_fragment(Http_response::Fragment fragment) {return add_bytes(fragment.text, fragment.len);}
     bool add_content(const char* content);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
+    bool add_headers(off_t content_length);
+    bool add_content_length(off_t content_length);
     bool add_linger();
     bool add_status_line(int status, const char* title);
+    bool add_date();
     bool add_blank_line();
+    bool add_ranges();
+    void advance_iov(size_t sent);
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
+    // shared by all the reactors, so it has to be atomic
+    static std::atomic<int> m_user_count;
     static db_conn_pool* m_connpool;
+    static Db_executor* m_db; // runs the sql of the registrations
 
     // key is username, value is password
-    static std::unordered_map<std::string, std::string> user_info;
+    static User_store user_info;
+
+    /* timeouts of the phases of a connection, in milliseconds. the header and body
+     * deadlines are counted from the start of the phase and are not extended by
+     * further reads, so a client dribbling bytes can't keep the slot forever */
+    static time_t m_header_timeout; // request line + headers complete
+    static time_t m_body_timeout; // body complete
+    static time_t m_idle_timeout; // idle between keep-alive requests
+    static time_t m_write_timeout; // no write progress
+
+    // files from this size on are sent with sendfile instead of mmap+writev
+    static size_t m_sendfile_threshold;
+
+    // largest request, and response header, a connection may buffer
+    static size_t m_buffer_limit;
+
+    // timer of this connection, linked into the timing wheel of its reactor
+    Timer m_timer;
+
+    // set by the reactor when the connection is queued, cleared by the worker when done
+    std::atomic<bool> m_busy;
+
+    // bumped by every init(sockfd), tells the completions of a former connection on the fd
+    unsigned m_generation;
 
 private:
     int m_sockfd;
     sockaddr_in m_address;
 
-    char m_read_buf[READ_BUFFER_SIZE];
-    
+    // epoll of the reactor owning this connection
+    int m_epollfd;
+    Handback* m_handback;
+
+    // both buffers go back to the pool while the connection is idle
+    Buffer m_read_buf;
+
     // mark the next position of the last read byte in m_read_buf 
     int m_read_idx;
 
@@ -116,7 +219,7 @@ private:
     // starting position of the line parsed currently 
     int m_start_line;
 
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    Buffer m_write_buf;
 
     // bytes to be sent in m_write_buf
     int m_write_idx;
@@ -130,7 +233,7 @@ private:
     char m_real_file[FILENAME_LEN];
 
     // name of the file requested by client
-    char* m_url;
+    const char* m_url;
 
     // version of http protocal
     char* m_version;
@@ -138,6 +241,9 @@ private:
     // name of host
     char* m_host;
 
+    // all the headers of the request, as offsets into m_read_buf
+    Http_request m_request;
+
     // length of http request message
     int m_content_length;
 
@@ -147,23 +253,61 @@ private:
     // starting position of requested file after mmap 
     char* m_file_address;
 
+    // keeps the mapping of m_file_address alive until the response is sent
+    File_ref m_file;
+
+    // the body is sent by sendfile from m_file->fd, starting at m_file_offset
+    bool m_sendfile;
+    off_t m_file_offset;
+
+    // the body is the gzip variant of m_file, m_file_address and m_file_stat.st_size describe it
+    bool m_gzip;
+
     struct stat m_file_stat;
 
-    struct iovec m_iv[2];
+    // a range of the file to send, both offsets inclusive as in the header
+    struct Range
+    {
+        off_t first;
+        off_t last;
+    };
+    Range m_ranges[MAX_RANGES];
+    int m_range_count; // 0 to send the whole file
+
+    // writev() resumes at m_iv[m_iv_first]
+    struct iovec m_iv[MAX_IOV];
     int m_iv_count;
+    int m_iv_first;
 
     int cgi; // used for post
     char* m_string;
-    Locker lock; // locker of user_info
 
-    int bytes_to_send;
-    int bytes_have_send;
+    // off_t, a file sent with sendfile may be larger than 2G
+    off_t bytes_to_send;
+    off_t bytes_have_send;
+
+    // set by init() when it kept pipelined bytes, see take_pipelined()
+    bool m_pipelined;
+
+    // waiting for the first byte of the next keep-alive request
+    bool m_idle;
+    time_t m_deadline;
 };
 
 int set_nonblocking(int fd);
-void addfd(int epollfd, int fd, bool one_shot);
+void addfd(int epollfd, int fd, bool one_shot, bool nonblock = true);
 void removefd(int epollfd, int fd);
 void modfd(int epollfd, int fd, int ev);
-void init_user_info();
+
+/* fill user_info, from the snapshot if there is one. true if it was loaded from the
+ * snapshot, then sync_user_info() is left to reconcile it with mysql in the background */
+bool init_user_info();
+void* sync_user_info(void* arg);
+
+// root directory of the static files
+extern const char* doc_root;
+
+// snapshot of the users, nullptr for none
+extern const char* user_snapshot;
 
 #endif
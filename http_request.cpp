@@ -0,0 +1,141 @@
+#include "http_request.h"
+#include <strings.h>
+
+namespace
+{
+
+struct Known_header
+{
+    const char* name;
+    int len;
+    Http_request::HEADER id;
+};
+
+#define KNOWN(name, id) {name, sizeof(name) - 1, Http_request::id}
+
+constexpr Known_header known_headers[] = {
+    KNOWN("Connection", CONNECTION),
+    KNOWN("Content-Length", CONTENT_LENGTH),
+    KNOWN("Host", HOST),
+    KNOWN("Accept-Encoding", ACCEPT_ENCODING),
+    KNOWN("If-None-Match", IF_NONE_MATCH),
+    KNOWN("If-Modified-Since", IF_MODIFIED_SINCE),
+    KNOWN("Range", RANGE),
+    KNOWN("If-Range", IF_RANGE),
+    KNOWN("Transfer-Encoding", TRANSFER_ENCODING),
+    KNOWN("Expect", EXPECT),
+    KNOWN("Cookie", COOKIE),
+};
+
+#undef KNOWN
+
+const int KNOWN_COUNT = sizeof(known_headers) / sizeof(known_headers[0]);
+const int TABLE_SIZE = 16;
+
+constexpr char lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// case-insensitive, only looks at the length and the first and last chars
+constexpr int header_hash(const char* name, int len)
+{
+    return (len * 4 + lower(name[0]) + lower(name[len - 1])) & (TABLE_SIZE - 1);
+}
+
+struct Header_table
+{
+    int8_t slots[TABLE_SIZE]; // index into known_headers, -1 if empty
+    bool perfect;
+};
+
+constexpr Header_table build_header_table()
+{
+    Header_table table = {};
+    for(int i = 0; i < TABLE_SIZE; ++i)
+    {
+        table.slots[i] = -1;
+    }
+    table.perfect = true;
+    for(int i = 0; i < KNOWN_COUNT; ++i)
+    {
+        int h = header_hash(known_headers[i].name, known_headers[i].len);
+        if(table.slots[h] != -1)
+        {
+            table.perfect = false;
+        }
+        table.slots[h] = i;
+    }
+    return table;
+}
+
+constexpr Header_table header_table = build_header_table();
+static_assert(header_table.perfect, "header_hash has a collision, change its factors");
+
+}
+
+Http_request::HEADER Http_request::lookup(const char* name, int len)
+{
+    if(len <= 0)
+    {
+        return UNKNOWN_HEADER;
+    }
+    // one candidate at most, confirmed by a single comparison
+    int slot = header_table.slots[header_hash(name, len)];
+    if(slot < 0 || known_headers[slot].len != len || strncasecmp(known_headers[slot].name, name, len) != 0)
+    {
+        return UNKNOWN_HEADER;
+    }
+    return known_headers[slot].id;
+}
+
+void Http_request::clear(const char* buf)
+{
+    m_buf = buf;
+    m_count = 0;
+    for(int i = 0; i < HEADER_COUNT; ++i)
+    {
+        m_known[i] = -1;
+    }
+}
+
+bool Http_request::add(const char* name, int name_len, const char* value, int value_len, HEADER& id)
+{
+    id = lookup(name, name_len);
+    if(m_count == MAX_FIELDS)
+    {
+        return false;
+    }
+
+    Field& field = m_fields[m_count];
+    field.name = name - m_buf;
+    field.name_len = name_len;
+    field.value = value - m_buf;
+    field.value_len = value_len;
+
+    // a repeated header: the first one wins
+    if(id != UNKNOWN_HEADER && m_known[id] < 0)
+    {
+        m_known[id] = m_count;
+    }
+    ++m_count;
+    return true;
+}
+
+const char* Http_request::value(HEADER id) const
+{
+    if(m_known[id] < 0)
+    {
+        return nullptr;
+    }
+    return m_buf + m_fields[m_known[id]].value;
+}
+
+int Http_request::value_len(HEADER id) const
+{
+    if(m_known[id] < 0)
+    {
+        return 0;
+    }
+    return m_fields[m_known[id]].value_len;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef HTTP_REQUEST_H
+#define HTTP_REQUEST_H
+
+#include <stdint.h>
+
+/* every header of the request being parsed, as offsets into the read buffer of
+ * its http_conn, so nothing is copied. the headers the server acts upon are found
+ * through a perfect hash of their names computed at compile time, see http_request.cpp */
+class Http_request
+{
+public:
+    enum HEADER {CONNECTION=0, CONTENT_LENGTH, HOST, ACCEPT_ENCODING, IF_NONE_MATCH,
+                 IF_MODIFIED_SINCE, RANGE, IF_RANGE, TRANSFER_ENCODING, EXPECT, COOKIE,
+                 HEADER_COUNT, UNKNOWN_HEADER = HEADER_COUNT};
+
+    // offsets and lengths in the read buffer, the value is '\0' terminated there
+    struct Field
+    {
+        uint32_t name;
+        uint32_t name_len;
+        uint32_t value;
+        uint32_t value_len;
+    };
+
+    static const int MAX_FIELDS = 64;
+
+    // start a new request whose lines are in buf
+    void clear(const char* buf);
+
+    // the read buffer has moved, the offsets stay valid
+    void rebase(const char* buf) {m_buf = buf;}
+
+    // record a header, return its id or UNKNOWN_HEADER. false if there are too many headers
+    bool add(const char* name, int name_len, const char* value, int value_len, HEADER& id);
+
+    static HEADER lookup(const char* name, int len);
+
+    bool has(HEADER id) const {return m_known[id] >= 0;}
+    const char* value(HEADER id) const;
+    int value_len(HEADER id) const;
+
+    int field_count() const {return m_count;}
+    const Field& field(int i) const {return m_fields[i];}
+    const char* base() const {return m_buf;}
+
+private:
+    const char* m_buf;
+    Field m_fields[MAX_FIELDS];
+    int m_count;
+    int8_t m_known[HEADER_COUNT]; // index into m_fields, -1 if absent
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "http_response.h"
+#include <string.h>
+#include <time.h>
+
+namespace
+{
+
+struct Status
+{
+    int status;
+    Http_response::Fragment line;
+};
+
+#define STATUS(status, title) {status, {"HTTP/1.1 " #status " " title "\r\n", sizeof("HTTP/1.1 " #status " " title "\r\n") - 1}}
+
+constexpr Status status_lines[] = {
+    STATUS(200, "OK"),
+    STATUS(206, "Partial Content"),
+    STATUS(304, "Not Modified"),
+    STATUS(400, "Bad Request"),
+    STATUS(403, "Forbidden"),
+    STATUS(404, "Not Found"),
+    STATUS(416, "Range Not Satisfiable"),
+    STATUS(500, "Internal Error"),
+    STATUS(501, "Not Implemented"),
+    STATUS(503, "Service Unavailable"),
+};
+
+#undef STATUS
+
+#define FRAGMENT(text) {text, sizeof(text) - 1}
+
+constexpr Http_response::Fragment keep_alive_line = FRAGMENT("Connection: keep-alive\r\n");
+constexpr Http_response::Fragment close_line = FRAGMENT("Connection: close\r\n");
+
+#undef FRAGMENT
+
+// "00" ... "99", two digits are written at a time
+constexpr char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+struct Date_cache
+{
+    time_t second;
+    int len;
+    char text[64];
+};
+
+thread_local Date_cache date_cache = {-1, 0, {0}};
+
+}
+
+Http_response::Fragment Http_response::status_line(int status)
+{
+    for(const Status& s : status_lines)
+    {
+        if(s.status == status)
+        {
+            return s.line;
+        }
+    }
+    return {"", 0};
+}
+
+Http_response::Fragment Http_response::connection(bool keep_alive)
+{
+    return keep_alive ? keep_alive_line : close_line;
+}
+
+Http_response::Fragment Http_response::date_server()
+{
+    time_t now = time(NULL);
+    if(now != date_cache.second)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        date_cache.len = strftime(date_cache.text, sizeof(date_cache.text),
+                                  "Date: %a, %d %b %Y %H:%M:%S GMT\r\nServer: toyserver\r\n", &tm);
+        date_cache.second = now;
+    }
+    return {date_cache.text, date_cache.len};
+}
+
+int Http_response::format_uint(char* out, uint64_t value)
+{
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while(value >= 100)
+    {
+        int pair = (value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if(value >= 10)
+    {
+        int pair = value * 2;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    else
+    {
+        *--p = '0' + value;
+    }
+
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return len;
+}
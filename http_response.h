@@ -0,0 +1,33 @@
+#pragma once
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stdint.h>
+
+/* pieces of the response header that are prebuilt at compile time or cached,
+ * so http_conn only copies bytes instead of formatting them with vsnprintf */
+namespace Http_response
+{
+
+struct Fragment
+{
+    const char* text;
+    int len;
+};
+
+// "HTTP/1.1 <status> <title>\r\n", len is 0 for a status we don't know
+Fragment status_line(int status);
+
+// "Connection: keep-alive\r\n" or "Connection: close\r\n"
+Fragment connection(bool keep_alive);
+
+/* "Date: <RFC 7231 date>\r\nServer: toyserver\r\n", formatted again at most
+ * once per second by every thread. valid until the next call in the same thread */
+Fragment date_server();
+
+// decimal digits of value into out, which has room for 20 chars, return their number
+int format_uint(char* out, uint64_t value);
+
+}
+
+#endif
@@ -3,8 +3,15 @@
 #define LOCKER_h 
 
 #include <exception>
+#include <atomic>
 #include <pthread.h>
 #include <semaphore.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
+#include <time.h>
+#include <errno.h>
 
 //class of managing semaphore resources
 class Sem
@@ -41,11 +48,29 @@ public:
         return sem_post(&m_sem);
     }
 
+    // wait at most ms milliseconds, return false on timeout
+    bool timed_wait(long ms)
+    {
+        struct timespec abstime;
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_sec += ms / 1000;
+        abstime.tv_nsec += (ms % 1000) * 1000000;
+        if(abstime.tv_nsec >= 1000000000)
+        {
+            abstime.tv_sec++;
+            abstime.tv_nsec -= 1000000000;
+        }
+        int ret;
+        while((ret = sem_timedwait(&m_sem, &abstime)) != 0 && errno == EINTR)
+        {
+        }
+        return ret == 0;
+    }
+
 private:
     sem_t m_sem;
 
 //copy constructor is forbidden
-//operator = will be called  in db_conn_pool.cpp
 private:
     Sem(const Sem&) = delete; 
 };
@@ -86,6 +111,47 @@ private:
     Locker& operator = (const Locker&) = delete;
 };
 
+//class of managing reader/writer lock resources
+class Rwlock
+{
+public:
+    Rwlock()
+    {
+        if(pthread_rwlock_init(&m_rwlock, NULL) != 0)
+        {
+            throw std::exception();
+        }
+    }
+
+    ~Rwlock()
+    {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+
+    int rdlock()
+    {
+        return pthread_rwlock_rdlock(&m_rwlock);
+    }
+
+    int wrlock()
+    {
+        return pthread_rwlock_wrlock(&m_rwlock);
+    }
+
+    int unlock()
+    {
+        return pthread_rwlock_unlock(&m_rwlock);
+    }
+
+private:
+    pthread_rwlock_t m_rwlock;
+
+//copy constructor and operator = is forbidden
+private:
+    Rwlock(const Rwlock&) = delete;
+    Rwlock& operator = (const Rwlock&) = delete;
+};
+
 //class of managing condition variable sources
 class Cond
 {
@@ -131,4 +197,51 @@ private:
     Cond(const Cond&) = delete;
     Cond& operator = (const Cond&) = delete;
 };
+//eventcount on a futex: lets threads sleep on a lock-free condition
+//a waiter calls prepare_wait(), re-checks its condition, then either cancel_wait() or wait(key)
+//a notifier first makes the condition true, then calls notify()
+class Eventcount
+{
+public:
+    Eventcount(): m_epoch(0), m_waiters(0) {}
+
+    unsigned prepare_wait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancel_wait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wait(unsigned key)
+    {
+        // returns at once if a notify() has bumped the epoch since prepare_wait()
+        syscall(SYS_futex, &m_epoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify(bool all = false)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // no syscall at all when nobody sleeps
+        if(m_waiters.load(std::memory_order_relaxed) == 0)
+        {
+            return;
+        }
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, &m_epoch, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+    }
+
+private:
+    std::atomic<unsigned> m_epoch;
+    std::atomic<int> m_waiters;
+
+//copy constructor and operator = is forbidden
+private:
+    Eventcount(const Eventcount&) = delete;
+    Eventcount& operator = (const Eventcount&) = delete;
+};
 #endif
@@ -1,11 +1,51 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include "webserver.h"
 
-int main()
+int main(int argc, char* argv[])
 {
+    int port = 8888;
+    int thread_num = 8;
+    int reactor_num = 1;
+
+    /* -p port, -t number of worker threads, -r number of reactors(event loops),
+     * -T header,body,idle,write timeouts in milliseconds,
+     * -s size in bytes from which files are sent with sendfile,
+     * -b largest request or response header in bytes a connection may buffer,
+     * -d root directory of the static files,
+     * -u snapshot file of the users, loaded at startup and written at shutdown */
+    int opt;
+    while((opt = getopt(argc, argv, "p:t:r:T:s:b:d:u:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 't': thread_num = atoi(optarg); break;
+            case 'r': reactor_num = atoi(optarg); break;
+            case 's': http_conn::m_sendfile_threshold = atol(optarg); break;
+            case 'b': http_conn::m_buffer_limit = atol(optarg); break;
+            case 'd': doc_root = optarg; break;
+            case 'u': user_snapshot = optarg; break;
+            case 'T':
+                {
+                    long header, body, idle, write;
+                    if(sscanf(optarg, "%ld,%ld,%ld,%ld", &header, &body, &idle, &write) == 4)
+                    {
+                        http_conn::m_header_timeout = header;
+                        http_conn::m_body_timeout = body;
+                        http_conn::m_idle_timeout = idle;
+                        http_conn::m_write_timeout = write;
+                    }
+                    break;
+                }
+            default: break;
+        }
+    }
+
     WebServer server;
-    server.init(8888, 8);
+    server.init(port, thread_num, reactor_num);
     server.event_listen();
     server.event_loop();
     return 0;
 }
-
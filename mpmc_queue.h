@@ -0,0 +1,144 @@
+#pragma once
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+/* bounded lock-free multi-producer multi-consumer queue(Dmitry Vyukov's ring buffer).
+ * every cell carries a sequence number telling whether it is ready to be written
+ * or read at a given position, so producers and consumers only contend on the
+ * cas of m_tail or m_head. the capacity is rounded up to a power of two */
+template<class T>
+class Mpmc_queue
+{
+public:
+    Mpmc_queue(size_t capacity);
+    ~Mpmc_queue();
+
+    // return false if the queue is full
+    bool push(const T& item);
+
+    // return false if the queue is empty
+    bool pop(T& item);
+
+    size_t capacity() const {return m_mask + 1;}
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    static const size_t CACHELINE = 64;
+
+    Cell* m_buffer;
+    size_t m_mask;
+
+    // keep the two ends on different cache lines
+    alignas(CACHELINE) std::atomic<size_t> m_tail; // next position to push
+    alignas(CACHELINE) std::atomic<size_t> m_head; // next position to pop
+
+private:
+    Mpmc_queue(const Mpmc_queue&) = delete;
+    Mpmc_queue& operator = (const Mpmc_queue&) = delete;
+};
+
+template<class T>
+Mpmc_queue<T>::Mpmc_queue(size_t capacity)
+{
+    if(capacity < 2)
+    {
+        capacity = 2;
+    }
+    size_t size = 1;
+    while(size < capacity)
+    {
+        size <<= 1;
+    }
+
+    m_buffer = new Cell[size];
+    m_mask = size - 1;
+    for(size_t i = 0; i < size; ++i)
+    {
+        m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_tail.store(0, std::memory_order_relaxed);
+    m_head.store(0, std::memory_order_relaxed);
+}
+
+template<class T>
+Mpmc_queue<T>::~Mpmc_queue()
+{
+    delete [] m_buffer;
+}
+
+template<class T>
+bool Mpmc_queue<T>::push(const T& item)
+{
+    Cell* cell;
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    while(true)
+    {
+        cell = &m_buffer[pos & m_mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0) // the cell is free at this position
+        {
+            if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0) // the cell still holds an item of the previous round
+        {
+            return false;
+        }
+        else // another producer took this position
+        {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->data = item;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T>
+bool Mpmc_queue<T>::pop(T& item)
+{
+    Cell* cell;
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    while(true)
+    {
+        cell = &m_buffer[pos & m_mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(diff == 0) // the cell has been written at this position
+        {
+            if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0) // nothing written yet
+        {
+            return false;
+        }
+        else // another consumer took this position
+        {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    item = cell->data;
+    // free the cell for the push of the next round
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+#endif
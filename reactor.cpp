@@ -0,0 +1,382 @@
+#include "reactor.h"
+#include <cassert>
+#include <poll.h>
+
+void addsig(int sig, void(handler)(int), bool restart = true)
+{
+    struct sigaction sa;
+    memset(&sa, 0x00, sizeof(sa));
+    sa.sa_handler = handler;
+    if(restart)
+    {
+        sa.sa_flags |= SA_RESTART;
+    }
+    sigfillset(&sa.sa_mask);
+    int ret = sigaction(sig, &sa, NULL);
+    assert(ret >= 0);
+}
+
+// answered by the reactor itself when the pool refuses a request, see Threadpool::append
+static const char overload_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+/* accept() fails with EMFILE while the connection stays queued, and an edge triggered
+ * listen socket doesn't report it again. the spare fd is given up to take the queued
+ * connections and close them, so their clients see a close rather than a hang */
+void shed_backlog(int listenfd, int& spare_fd)
+{
+    if(spare_fd >= 0)
+    {
+        close(spare_fd);
+    }
+    while(true)
+    {
+        // the listen socket of the uring reactor blocks, so look before accepting
+        struct pollfd pfd = {listenfd, POLLIN, 0};
+        if(poll(&pfd, 1, 0) <= 0)
+        {
+            break;
+        }
+        int connfd = accept(listenfd, NULL, NULL);
+        if(connfd < 0)
+        {
+            break;
+        }
+        close(connfd);
+    }
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void handled_signals(sigset_t* mask)
+{
+    sigemptyset(mask);
+    sigaddset(mask, SIGTERM);
+    sigaddset(mask, SIGUSR1);
+}
+
+void print_stats(Conn_pool* pool)
+{
+    printf("requests shed with 503: %ld queue full, %ld queue delay\n",
+           pool->shed_full(), pool->shed_delay());
+    printf("users written behind: %ld rows in %ld batches, %ld rows failed\n",
+           http_conn::m_db->rows(), http_conn::m_db->batches(), http_conn::m_db->failed());
+    db_conn_pool::Stats db = http_conn::m_connpool->stats();
+    printf("mysql connections: %ld acquired, %ld us average wait, %ld in use, %ld idle, "
+           "%ld created, %ld closed, %ld failed, %ld timeouts\n",
+           db.acquired, db.acquired ? db.wait_us / db.acquired : 0, db.in_use, db.idle,
+           db.created, db.closed, db.failed, db.timeouts);
+    fflush(stdout);
+}
+
+/* the signals are blocked in every thread and read by reactor 0 from a signalfd,
+ * so no handler ever interrupts a syscall of the workers */
+void block_signals()
+{
+    sigset_t mask;
+    handled_signals(&mask);
+    int ret = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    assert(ret == 0);
+    addsig(SIGPIPE, SIG_IGN);
+}
+
+Reactor::Reactor(int id, Conn_table* users, Conn_pool* pool):
+    m_id(id), m_sigfd(-1), m_inotifyfd(-1), m_spare_fd(-1), users(users), m_pool(pool)
+{
+}
+
+Reactor::~Reactor()
+{
+    close(m_epollfd);
+    close(m_listenfd);
+    close(m_eventfd);
+    if(m_spare_fd >= 0)
+    {
+        close(m_spare_fd);
+    }
+    if(m_sigfd >= 0)
+    {
+        close(m_sigfd);
+    }
+}
+
+void Reactor::event_listen(int port)
+{
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(m_listenfd  >= 0);
+
+    /* no SO_LINGER {1,0} here: the accepted sockets would inherit it, and their close()
+     * would reset the connection and drop the tail of a response still in the send buffer */
+    int reuse = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // every reactor binds its own listen socket to the same port
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    int ret = bind(m_listenfd, (struct sockaddr*)&address, sizeof(address));
+    assert(ret >= 0);
+
+    ret = listen(m_listenfd, SOMAXCONN);
+    assert(ret >= 0);
+    m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    m_epollfd= epoll_create(5);
+    assert(m_epollfd >= 0);
+    addfd(m_epollfd, m_listenfd, false);
+
+    m_eventfd = eventfd(0, EFD_NONBLOCK);
+    assert(m_eventfd >= 0);
+    addfd(m_epollfd, m_eventfd, false);
+
+    if(m_id == 0)
+    {
+        sigset_t mask;
+        handled_signals(&mask);
+        m_sigfd = signalfd(-1, &mask, SFD_NONBLOCK);
+        assert(m_sigfd >= 0);
+        addfd(m_epollfd, m_sigfd, false);
+
+        m_inotifyfd = File_cache::get_instance()->inotify_fd();
+        if(m_inotifyfd >= 0)
+        {
+            addfd(m_epollfd, m_inotifyfd, false);
+        }
+    }
+}
+
+void Reactor::stop()
+{
+    uint64_t one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+}
+
+void Reactor::timer(int connfd, const sockaddr_in& client_address)
+{
+    http_conn* conn = users->get(connfd);
+    conn->init(connfd, client_address, m_epollfd);
+    timer_wheel.schedule(&conn->m_timer, conn->deadline());
+}
+
+void Reactor::close_conn(int sockfd)
+{
+    /* a worker is still using the connection: only shut it down, the worker's
+     * re-arm then reports EPOLLHUP and we come back here once it is done */
+    if(user(sockfd).m_busy)
+    {
+        shutdown(sockfd, SHUT_RDWR);
+        return;
+    }
+    timer_wheel.del_timer(&user(sockfd).m_timer);
+    user(sockfd).close_conn();
+}
+
+bool Reactor::handle_newclient()
+{
+    // the listen socket is edge triggered, so accept until the queue is drained
+    while(true)
+    {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength, SOCK_NONBLOCK);
+        if(connfd < 0)
+        {
+            if(errno == EMFILE || errno == ENFILE)
+            {
+                shed_backlog(m_listenfd, m_spare_fd);
+                return false;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        // users is indexed by fd, so a larger one is refused whatever the count says
+        if(connfd >= MAX_FD || http_conn::m_user_count + 4 >= MAX_FD)
+        {
+            close(connfd);
+            continue;
+        }
+
+        timer(connfd, client_address);
+    }
+}
+
+bool Reactor::handle_signal(bool &stop_server)
+{
+    struct signalfd_siginfo signals[16];
+    int ret = ::read(m_sigfd, signals, sizeof(signals));
+    if(ret <= 0)
+    {
+        return false;
+    }
+
+    for(int i = 0; i < ret / (int)sizeof(signalfd_siginfo); i++)
+    {
+        switch(signals[i].ssi_signo)
+        {
+        case SIGTERM:
+            {
+                stop_server = true;
+                for(Reactor* peer : m_peers)
+                {
+                    peer->stop();
+                }
+                break;
+            }
+        case SIGUSR1:
+            {
+                print_stats(m_pool);
+                break;
+            }
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+// no response is pending, so the socket has room for these few bytes
+void send_overload(int sockfd)
+{
+    send(sockfd, overload_response, sizeof(overload_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// shed a request the pool can't take
+void Reactor::reject(int sockfd)
+{
+    send_overload(sockfd);
+    close_conn(sockfd);
+}
+
+// hand a connection with a request in its read buffer to the pool
+void Reactor::dispatch(int sockfd)
+{
+    user(sockfd).m_busy = true;
+    if(!m_pool->append(&user(sockfd), m_id))
+    {
+        user(sockfd).m_busy = false;
+        reject(sockfd);
+    }
+}
+
+void Reactor::handle_read(int sockfd)
+{
+    if(user(sockfd).read())
+    {
+        timer_wheel.schedule(&user(sockfd).m_timer, user(sockfd).deadline());
+        dispatch(sockfd);
+    }
+    else
+    {
+        close_conn(sockfd);
+    }
+}
+
+void Reactor::handle_write(int sockfd)
+{
+    if(user(sockfd).write())
+    {
+        timer_wheel.schedule(&user(sockfd).m_timer, user(sockfd).deadline());
+        if(user(sockfd).take_pipelined())
+        {
+            dispatch(sockfd);
+        }
+    }
+    else
+    {
+        close_conn(sockfd);
+    }
+}
+
+/* a connection is only closed when the deadline of its current phase has passed.
+ * the worker may have moved it into another phase since the timer was set, and one
+ * still queued or being processed gets m_write_timeout more to produce its response.
+ * an expired one is only shut down: a worker which has just cleared m_busy may still
+ * re-arm its fd, so the fd is closed on the EPOLLHUP that follows, never here, and
+ * its number can't be reused under the worker */
+void Reactor::handle_timeout()
+{
+    m_expired.clear();
+    timer_wheel.tick(m_expired);
+
+    time_t cur = now_ms();
+    for(Timer* timer : m_expired)
+    {
+        http_conn* user = timer->user;
+        if(user->m_busy)
+        {
+            timer_wheel.schedule(timer, cur + http_conn::m_write_timeout);
+        }
+        else if(user->deadline() > cur)
+        {
+            timer_wheel.schedule(timer, user->deadline());
+        }
+        else
+        {
+            shutdown(user->sockfd(), SHUT_RDWR);
+        }
+    }
+}
+
+void Reactor::event_loop()
+{
+    pin_thread(m_id % m_pool->groups(), m_pool->groups());
+    bool stop_server = false;
+
+    while(!stop_server)
+    {
+        // sleep until the next timer tick is due, or forever if there is no timer
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, timer_wheel.next_timeout());
+        if(number < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        for(int i = 0; i < number; i++)
+        {
+            int sockfd = events[i].data.fd;
+
+            if(sockfd == m_listenfd)
+            {
+                bool flag = handle_newclient();
+                if(!flag)
+                {
+                    continue;
+                }
+            }
+            else if(sockfd == m_sigfd)
+            {
+                handle_signal(stop_server);
+            }
+            else if(sockfd == m_eventfd)
+            {
+                stop_server = true;
+            }
+            else if(sockfd == m_inotifyfd)
+            {
+                File_cache::get_instance()->handle_inotify();
+            }
+            else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                close_conn(sockfd);
+            }
+            else if(events[i].events & EPOLLIN)
+            {
+                handle_read(sockfd);
+            }
+            else if(events[i].events & EPOLLOUT)
+            {
+                handle_write(sockfd);
+            }
+        }
+
+        handle_timeout();
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <vector>
+#include "http_conn.h"
+#include "conn_table.h"
+#include "threadpool.h"
+#include "timer.h"
+
+// the requests read by a reactor go to its own queue, see Stealing_queue
+typedef Threadpool<http_conn, Stealing_queue> Conn_pool;
+
+const int MAX_FD = 65536;
+const int MAX_EVENT_NUMBER = 10000;
+
+// block the signals handled through signalfd, before any thread is created
+void block_signals();
+
+// the signals read from the signalfd of reactor 0
+void handled_signals(sigset_t* mask);
+
+// answer 503 to a request the pool refused, see Threadpool::append
+void send_overload(int sockfd);
+
+// the requests shed and the state of the mysql connections, at exit and on SIGUSR1
+void print_stats(Conn_pool* pool);
+
+// close the connections queued on listenfd while no fd is left, see handle_newclient
+void shed_backlog(int listenfd, int& spare_fd);
+
+/* one event loop: it owns an epoll fd, a SO_REUSEPORT listen socket and a timing wheel.
+ * the kernel spreads new connections over the listen sockets of all the reactors,
+ * and a connection stays on the reactor that accepted it until it is closed,
+ * so every reactor only touches the connections of users indexed by its own fds */
+class Reactor
+{
+public:
+    Reactor(int id, Conn_table* users, Conn_pool* pool);
+    ~Reactor();
+
+    void event_listen(int port);
+    void event_loop();
+    bool handle_newclient();
+    bool handle_signal(bool &stop_server);
+    void handle_read(int sockfd);
+    void handle_write(int sockfd);
+    void timer(int connfd, const struct sockaddr_in &client_address);
+    void close_conn(int sockfd);
+    void reject(int sockfd);
+    void dispatch(int sockfd);
+    void handle_timeout();
+
+    // wake this reactor up from another thread and make it quit
+    void stop();
+
+    // reactor 0 receives the signals and stops the others
+    std::vector<Reactor*> m_peers;
+
+private:
+    int m_id;
+    int m_epollfd;
+    int m_listenfd;
+    int m_sigfd; // signalfd, reactor 0 only
+    int m_inotifyfd; // inotify of the file cache, reactor 0 only
+    int m_eventfd; // written by stop()
+    int m_spare_fd; // given up to accept when the fds run out
+    Conn_table *users; // shared by all the reactors, indexed by fd
+
+    // the connection of an fd accepted by this reactor
+    http_conn& user(int sockfd) {return *users->find(sockfd);}
+
+    Conn_pool *m_pool;
+
+    epoll_event events[MAX_EVENT_NUMBER];
+
+    // the timers themselves live in the http_conn of each fd
+    Timer_wheel timer_wheel;
+    std::vector<Timer*> m_expired;
+};
+
+#endif
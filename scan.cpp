@@ -0,0 +1,140 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static const char* find_eol_scalar(const char* p, const char* end)
+{
+    for(; p < end; ++p)
+    {
+        if(*p == '\r' || *p == '\n')
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+static const char* find_char_scalar(const char* p, const char* end, char c)
+{
+    for(; p < end; ++p)
+    {
+        if(*p == c)
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static const char* find_eol_sse2(const char* p, const char* end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for(; p + 16 <= end; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf));
+        int mask = _mm_movemask_epi8(hit);
+        if(mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_eol_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char* find_char_sse2(const char* p, const char* end, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    for(; p + 16 <= end; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if(mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_char_scalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char* find_eol_avx2(const char* p, const char* end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for(; p + 32 <= end; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if(mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_eol_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_char_avx2(const char* p, const char* end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    for(; p + 32 <= end; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if(mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_char_sse2(p, end, c);
+}
+#endif
+
+struct Scanner
+{
+    const char* (*eol)(const char*, const char*);
+    const char* (*chr)(const char*, const char*, char);
+    const char* name;
+};
+
+static Scanner choose_scanner()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return {find_eol_avx2, find_char_avx2, "avx2"};
+    }
+    if(__builtin_cpu_supports("sse2"))
+    {
+        return {find_eol_sse2, find_char_sse2, "sse2"};
+    }
+#endif
+    return {find_eol_scalar, find_char_scalar, "scalar"};
+}
+
+static const Scanner scanner = choose_scanner();
+
+const char* find_eol(const char* p, const char* end)
+{
+    return scanner.eol(p, end);
+}
+
+const char* find_char(const char* p, const char* end, char c)
+{
+    return scanner.chr(p, end, c);
+}
+
+const char* scan_impl()
+{
+    return scanner.name;
+}
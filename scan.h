@@ -0,0 +1,18 @@
+#pragma once
+#ifndef SCAN_H
+#define SCAN_H
+
+/* vectorized scanning of the read buffer. the implementation is chosen once at
+ * startup from what the cpu supports: AVX2(32 bytes at a time), SSE2(16 bytes)
+ * or a plain byte loop. both functions return end if nothing is found */
+
+// first '\r' or '\n' in [p, end)
+const char* find_eol(const char* p, const char* end);
+
+// first c in [p, end)
+const char* find_char(const char* p, const char* end, char c);
+
+// name of the implementation in use: "avx2", "sse2" or "scalar"
+const char* scan_impl();
+
+#endif
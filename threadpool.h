@@ -2,44 +2,76 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H 
 
-#include <deque>
 #include <cstdio>
+#include <atomic>
 #include "locker.h"
+#include "work_queue.h"
+#include "admission.h"
 
-// T stands for the class of tasks 
-template<class T>
+// T stands for the class of tasks, Queue for the scheduling policy, see work_queue.h
+template<class T, template<class> class Queue = Shared_queue>
 class Threadpool
 {
 public:
-    Threadpool(int thread_number = 8, int max_requests = 10000);
+    Threadpool(int thread_number = 8, int max_requests = 10000, int queue_number = 1);
     ~Threadpool();
-    int append(T* request); //add a request to the queue
+
+    /* add a request to the queue, hint is the index of the producer. return false and
+     * leave the request to the caller when the queue is full or overloaded, see Codel */
+    int append(T* request, int hint = 0);
+
+    // requests refused by append() because the queue was full or the waits too long
+    long shed_full() const {return m_shed_full.load(std::memory_order_relaxed);}
+    long shed_delay() const {return m_shed_delay.load(std::memory_order_relaxed);}
+
+    // the groups of workers, a reactor pins itself with its own, see pin_thread()
+    int groups() const {return m_workqueue.groups();}
 
 private:
+    struct Worker
+    {
+        Threadpool* pool;
+        int id;
+    };
+
+    struct Task
+    {
+        T* request;
+        time_t enqueue; // now_ms() at append()
+    };
+
     static void* thread_work(void* arg); //function of threads
-    void run(); //function of requests
+    void run(int id); //function of requests
 
 private:
     int m_thread_number;
-    int m_max_requests;
+    int m_max_requests; // capacity of m_workqueue, rounded up to powers of two
     pthread_t* m_threads; //array of threads, with number of m_thread_number 
-    std::deque<T*> m_workqueue; //queue of requests 
-    Locker m_queuelocker; //mutex of m_workqueue
-    Sem empty_queue;
-    int m_stop;
+    Worker* m_workers;
+    Queue<Task> m_workqueue; //lock-free queue(s) of requests
+    Eventcount m_event; //idle workers sleep here while m_workqueue is empty
+    std::atomic<int> m_stop;
+
+    Codel m_codel;
+    std::atomic<long> m_shed_full;
+    std::atomic<long> m_shed_delay;
 };
 
-template<class T>
-Threadpool<T>::Threadpool(int thread_number, int max_requests):
+template<class T, template<class> class Queue>
+Threadpool<T, Queue>::Threadpool(int thread_number, int max_requests, int queue_number):
     m_thread_number(thread_number), m_max_requests(max_requests),
-    m_stop(0), m_threads(nullptr)
+    m_threads(nullptr), m_workers(nullptr),
+    m_workqueue(queue_number, thread_number > 0 ? thread_number : 1, max_requests > 0 ? max_requests : 1),
+    m_stop(0), m_shed_full(0), m_shed_delay(0)
 {
     if(thread_number <= 0 || max_requests <= 0)
     {
         throw std::exception();
     }
+    m_max_requests = m_workqueue.capacity();
 
     m_threads = new pthread_t[m_thread_number];
+    m_workers = new Worker[m_thread_number];
     if(!m_threads)
     {
         throw std::exception();
@@ -49,7 +81,9 @@ Threadpool<T>::Threadpool(int thread_number, int max_requests):
     for(int i=0;  i<thread_number; ++i)
     {
         //printf("create the %dth thread\n", i);
-        if(pthread_create(m_threads+i, NULL, thread_work, this) != 0)
+        m_workers[i].pool = this;
+        m_workers[i].id = i;
+        if(pthread_create(m_threads+i, NULL, thread_work, m_workers+i) != 0)
         {
             delete [] m_threads;
             throw std::exception();
@@ -62,55 +96,73 @@ Threadpool<T>::Threadpool(int thread_number, int max_requests):
     }
 }
 
-template<class T>
-Threadpool<T>::~Threadpool()
+template<class T, template<class> class Queue>
+Threadpool<T, Queue>::~Threadpool()
 {
     delete [] m_threads;
+    delete [] m_workers;
     m_stop = 1;
+    m_event.notify(true);
 }
 
-template<class T>
-int Threadpool<T>::append(T* request)
+template<class T, template<class> class Queue>
+int Threadpool<T, Queue>::append(T* request, int hint)
 {
-    m_queuelocker.lock();
-    if(m_workqueue.size() >= m_max_requests)
+    if(m_codel.shedding())
+    {
+        m_shed_delay.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Task task = {request, now_ms()};
+    if(!m_workqueue.push(task, hint))
     {
         //printf("---append failure, line 78---\n");
-        m_queuelocker.unlock();
+        m_shed_full.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
-    m_workqueue.push_back(request);
-    //printf("a request comes in\n");
-    m_queuelocker.unlock();
-    empty_queue.post();
+    m_event.notify();
     return 1;
 }
 
-template<class T>
-void* Threadpool<T>::thread_work(void* arg)
+template<class T, template<class> class Queue>
+void* Threadpool<T, Queue>::thread_work(void* arg)
 {
-    Threadpool* pool = (Threadpool*)arg;
-    pool->run();
-    return pool;
+    Worker* worker = (Worker*)arg;
+    worker->pool->run(worker->id);
+    return worker->pool;
 }
 
-template<class T>
-void Threadpool<T>::run()
+template<class T, template<class> class Queue>
+void Threadpool<T, Queue>::run(int id)
 {
+    pin_thread(m_workqueue.group(id), m_workqueue.groups());
     while(!m_stop)
     {
-        //printf("---might blocked here, line 102, threadpool.h---\n");
-        empty_queue.wait();
-        m_queuelocker.lock();
-        if(m_workqueue.empty())
+        Task task = {nullptr, 0};
+        if(!m_workqueue.pop(task, id))
         {
-            //printf("empty_queue\n");
-            m_queuelocker.unlock();
-            continue;
+            m_codel.on_empty();
+
+            // park only when the queue is still empty after announcing ourselves
+            unsigned key = m_event.prepare_wait();
+            if(m_workqueue.pop(task, id) || m_stop)
+            {
+                m_event.cancel_wait();
+            }
+            else
+            {
+                m_event.wait(key);
+                continue;
+            }
+        }
+
+        T* request = task.request;
+        if(request)
+        {
+            time_t now = now_ms();
+            m_codel.on_dequeue(now - task.enqueue, now);
         }
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
 
         if(!request)
         {
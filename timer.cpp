@@ -1,104 +1,148 @@
 #include "timer.h"
 
-static const int MAX_FD = 65536;
-
-Timer::Timer()
+time_t now_ms()
 {
-    expire = 1;
-    valid = true;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
-Timer::Timer(time_t delay)
+
+Timer::Timer()
 {
-    expire = time(NULL) + delay;
-    valid = true;
+    expire = 0;
+    user = nullptr;
+    prev = nullptr;
+    next = nullptr;
+    slot = -1;
 }
 
-void Timer::terminate(int epollfd)
+Timer_wheel::Timer_wheel()
 {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, sockfd, 0);
-    close(sockfd);
-    http_conn::m_user_count--;
+    for(int i = 0; i < SLOTS; i++)
+    {
+        slots[i] = nullptr;
+    }
+    m_cur_tick = now_ms() / TICK_MS;
+    m_count = 0;
 }
 
-Timer_heap::Timer_heap(int epollfd)
+bool Timer_wheel::empty() const
 {
-    this->epollfd = epollfd;
-    heap.reserve(MAX_FD);
+    return m_count == 0;
 }
 
-bool Timer_heap::empty() const
+int Timer_wheel::next_timeout() const
 {
-    return heap.empty();
+    if(m_count == 0)
+    {
+        return -1;
+    }
+
+    time_t tick = m_cur_tick;
+    while(!slots[tick % SLOTS] && tick < m_cur_tick + SLOTS)
+    {
+        ++tick;
+    }
+
+    // the slot of a tick is processed once the tick has completely passed
+    time_t timeout = (tick + 1) * TICK_MS - now_ms();
+    return timeout > 0 ? timeout : 0;
 }
 
-void Timer_heap::add_timer(Timer* timer)
+void Timer_wheel::link(Timer* timer)
 {
-    if(heap.empty())
+    time_t tick = timer->expire / TICK_MS;
+    // never hash a timer into a slot that has already been processed
+    if(tick < m_cur_tick)
     {
-        heap.push_back(timer);
-        return;
+        tick = m_cur_tick;
     }
-    heap.push_back(timer);
-    push_heap(heap.begin(), heap.end(), Timer_cmp());
+    int slot = tick % SLOTS;
+
+    timer->slot = slot;
+    timer->prev = nullptr;
+    timer->next = slots[slot];
+    if(slots[slot])
+    {
+        slots[slot]->prev = timer;
+    }
+    slots[slot] = timer;
+    ++m_count;
 }
 
-void Timer_heap::pop_timer()
+void Timer_wheel::unlink(Timer* timer)
 {
-    Timer* tmp = heap.front();
-    pop_heap(heap.begin(), heap.end(), Timer_cmp());
-    heap.pop_back();
-    delete tmp;
+    if(timer->prev)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        slots[timer->slot] = timer->next;
+    }
+    if(timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    timer->slot = -1;
+    --m_count;
 }
 
-void Timer_heap::del_timer(Timer* timer)
+void Timer_wheel::add_timer(Timer* timer, time_t delay)
 {
-    timer->valid = false;
-    timer->expire = 1;   
-    // actually, we didn't remove the timer from the heap
+    schedule(timer, now_ms() + delay);
 }
 
-Timer* Timer_heap::top() const
+void Timer_wheel::schedule(Timer* timer, time_t expire)
 {
-    if(heap.empty())
+    if(timer->linked())
     {
-        return nullptr;
-    }
-    else
-    {
-        return heap.front();
+        unlink(timer);
     }
+    timer->expire = expire;
+    link(timer);
 }
 
-void Timer_heap::adjust_timer(Timer* timer, time_t delay)
+void Timer_wheel::adjust_timer(Timer* timer, time_t delay)
 {
     // update expire time if the there is something new on this connection
-    timer->expire = time(NULL) + delay;
+    add_timer(timer, delay);
 }
 
-void Timer_heap::reheap()
+void Timer_wheel::del_timer(Timer* timer)
 {
-    make_heap(heap.begin(), heap.end(), Timer_cmp());
+    if(timer->linked())
+    {
+        unlink(timer);
+    }
 }
 
-void Timer_heap::tick()
+void Timer_wheel::tick(std::vector<Timer*>& expired)
 {
-    Timer *tmp = top();
-    time_t cur = time(NULL);
-    while(!heap.empty())
+    time_t cur = now_ms();
+    time_t cur_tick = cur / TICK_MS;
+
+    // after a long sleep one round over the wheel is enough
+    if(cur_tick - m_cur_tick > SLOTS)
     {
-        if(!tmp)
-        {
-            break;
-        }
-        if(tmp->expire > cur)
-        {
-            break;
-        }
-        if(tmp->valid)
+        m_cur_tick = cur_tick - SLOTS;
+    }
+
+    // only the ticks that have completely passed, so a whole slot can expire at once
+    for(; m_cur_tick < cur_tick; ++m_cur_tick)
+    {
+        Timer* tmp = slots[m_cur_tick % SLOTS];
+        while(tmp)
         {
-            tmp->terminate(epollfd);
+            Timer* next = tmp->next;
+            if(tmp->expire <= cur)
+            {
+                unlink(tmp);
+                expired.push_back(tmp);
+            }
+            tmp = next;
         }
-        pop_timer();
-        tmp = top();
     }
 }
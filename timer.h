@@ -9,52 +9,63 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/epoll.h>
-#include <deque>
-#include <queue>
-#include <algorithm>
-#include "http_conn.h"
+#include <vector>
 
+class http_conn;
+
+// milliseconds of CLOCK_MONOTONIC
+time_t now_ms();
+
+/* a node of the timing wheel, embedded in every http_conn,
+ * so adding or refreshing a timer never allocates */
 class Timer
 {
 public:
     Timer();
-    Timer(time_t delay);
     ~Timer() {}
-    void terminate(int epollfd);
 
-    time_t expire;
-    int sockfd;
+    bool linked() const {return slot >= 0;}
 
-    bool valid;
-};
+    time_t expire; // in milliseconds, see now_ms()
+    http_conn* user;
 
-struct Timer_cmp
-{
-    bool operator() (Timer* a, Timer* b)
-    {
-        return a->expire > b->expire;
-    }    
+    // position in the wheel, slot is -1 when the timer is not in the wheel
+    Timer* prev;
+    Timer* next;
+    int slot;
 };
 
-class Timer_heap
+/* hashed timing wheel: timers are hashed by their expire tick into SLOTS doubly linked
+ * lists, so add_timer, adjust_timer and del_timer are all O(1). a timer that lies more
+ * than one round ahead just stays in its slot until a later round reaches its expire */
+class Timer_wheel
 {
 public:
-    Timer_heap(int epollfd);
-    void add_timer(Timer* timer);
-    void pop_timer();
-    void del_timer(Timer* timer);
+    Timer_wheel();
+    ~Timer_wheel() {}
+
+    void add_timer(Timer* timer, time_t delay); // delay in milliseconds
     void adjust_timer(Timer* timer, time_t delay);
-    void reheap(); // keep the heap structure
+    void schedule(Timer* timer, time_t expire); // absolute expire, see now_ms()
+    void del_timer(Timer* timer);
     bool empty() const;
-    Timer* top() const;
+
+    // milliseconds until the next non-empty slot is due, -1 if there is no timer at all
+    int next_timeout() const;
     
-    // this function will be called if there is a expired timer
-    void tick();
+    // unlink all the timers expired up to now and hand them to the owner in expired
+    void tick(std::vector<Timer*>& expired);
 
-    int epollfd;
+private:
+    void link(Timer* timer);
+    void unlink(Timer* timer);
 
 private:
-    std::vector<Timer*> heap;
+    static const int SLOTS = 512;
+    static const int TICK_MS = 10;
+
+    Timer* slots[SLOTS];
+    time_t m_cur_tick; // the next tick to be processed
+    int m_count;
 };
 #endif
-
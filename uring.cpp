@@ -0,0 +1,210 @@
+#include "uring.h"
+
+#ifdef USE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+Uring::Uring():
+    m_fd(-1), m_sq_ring(MAP_FAILED), m_sq_ring_size(0), m_cq_ring(MAP_FAILED), m_cq_ring_size(0),
+    m_sqes((io_uring_sqe*)MAP_FAILED), m_sqes_size(0), m_buf_ring((io_uring_buf_ring*)MAP_FAILED), m_buf_ring_size(0),
+    m_buffers((char*)MAP_FAILED), m_buffer_size(0), m_buffer_count(0), m_buf_tail(0)
+{
+}
+
+Uring::~Uring()
+{
+    if(m_buffers != MAP_FAILED)
+    {
+        munmap(m_buffers, (size_t)m_buffer_count * m_buffer_size);
+    }
+    if(m_buf_ring != MAP_FAILED)
+    {
+        munmap(m_buf_ring, m_buf_ring_size);
+    }
+    if(m_sqes != MAP_FAILED)
+    {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if(m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+    {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    if(m_sq_ring != MAP_FAILED)
+    {
+        munmap(m_sq_ring, m_sq_ring_size);
+    }
+    if(m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+bool Uring::init(unsigned entries)
+{
+    /* only the owner thread submits, and the completions are only run when it waits
+     * for them, which saves the kernel interrupting it. older kernels get a plain ring */
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(m_fd < 0 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if(m_fd < 0)
+    {
+        return false;
+    }
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap && m_cq_ring_size > m_sq_ring_size)
+    {
+        m_sq_ring_size = m_cq_ring_size;
+    }
+
+    m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sq_ring == MAP_FAILED)
+    {
+        return false;
+    }
+    m_cq_ring = single_mmap ? m_sq_ring
+                            : mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if(m_cq_ring == MAP_FAILED)
+    {
+        return false;
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(m_sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    char* sq = (char*)m_sq_ring;
+    m_sq_head = (unsigned*)(sq + params.sq_off.head);
+    m_sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    m_sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_sqe_tail = *m_sq_tail;
+
+    // slot i of the submission queue always holds sqe i
+    unsigned* array = (unsigned*)(sq + params.sq_off.array);
+    for(unsigned i = 0; i < m_sq_entries; i++)
+    {
+        array[i] = i;
+    }
+
+    char* cq = (char*)m_cq_ring;
+    m_cq_head = (unsigned*)(cq + params.cq_off.head);
+    m_cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    m_cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+int Uring::enter(unsigned to_submit, unsigned wait_nr, unsigned flags)
+{
+    int ret;
+    while((ret = syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, flags, NULL, 0)) < 0 && errno == EINTR)
+    {
+    }
+    return ret;
+}
+
+io_uring_sqe* Uring::get_sqe()
+{
+    if(m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+    {
+        submit_and_wait(0);
+        if(m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+        {
+            return nullptr;
+        }
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++m_sqe_tail;
+    return sqe;
+}
+
+int Uring::submit_and_wait(unsigned wait_nr)
+{
+    unsigned to_submit = m_sqe_tail - *m_sq_tail;
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+    if(to_submit == 0 && wait_nr == 0)
+    {
+        return 0;
+    }
+    return enter(to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+io_uring_cqe* Uring::peek_cqe()
+{
+    unsigned head = *m_cq_head;
+    if(head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return nullptr;
+    }
+    return &m_cqes[head & m_cq_mask];
+}
+
+void Uring::cqe_seen()
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool Uring::setup_buffers(int group, unsigned count, unsigned size)
+{
+    // the kernel wants a power of two of entries, in page aligned memory
+    m_buf_ring_size = count * sizeof(io_uring_buf);
+    m_buf_ring = (io_uring_buf_ring*)mmap(NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m_buf_ring == MAP_FAILED)
+    {
+        return false;
+    }
+    m_buffers = (char*)mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m_buffers == MAP_FAILED)
+    {
+        return false;
+    }
+    m_buffer_count = count;
+    m_buffer_size = size;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)m_buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if(syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        return false;
+    }
+
+    m_buf_tail = 0;
+    for(unsigned i = 0; i < count; i++)
+    {
+        recycle_buffer(i);
+    }
+    return true;
+}
+
+void Uring::recycle_buffer(int bid)
+{
+    /* the tail overlays a reserved field of the first entry, so the entries are set field
+     * by field. they are indexed from the start of the ring: in c++ the flexible array of
+     * the kernel header lands 8 bytes past it */
+    io_uring_buf* buf = (io_uring_buf*)m_buf_ring + (m_buf_tail & (m_buffer_count - 1));
+    buf->addr = (unsigned long)buffer(bid);
+    buf->len = m_buffer_size;
+    buf->bid = bid;
+    ++m_buf_tail;
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+#ifndef URING_H
+#define URING_H
+
+#ifdef USE_IO_URING
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+/* a minimal io_uring on the raw syscalls, so there's no liburing to link. one thread
+ * owns the ring: it takes the sqes, submits them and reaps the completions. a provided
+ * buffer ring lends the kernel buffers to receive into, picked when the data arrives */
+class Uring
+{
+public:
+    Uring();
+    ~Uring();
+
+    // false if the kernel has no io_uring, or not the features used here
+    bool init(unsigned entries);
+
+    // a cleared sqe, the ones taken so far are submitted first if the ring is full
+    io_uring_sqe* get_sqe();
+
+    // submit the sqes taken and wait for at least wait_nr completions
+    int submit_and_wait(unsigned wait_nr);
+
+    // the next completion, or nullptr. cqe_seen() gives it back to the kernel
+    io_uring_cqe* peek_cqe();
+    void cqe_seen();
+
+    // count buffers of size bytes for recvs with IOSQE_BUFFER_SELECT from group
+    bool setup_buffers(int group, unsigned count, unsigned size);
+    char* buffer(int bid) const {return m_buffers + (size_t)bid * m_buffer_size;}
+    void recycle_buffer(int bid);
+
+private:
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    int enter(unsigned to_submit, unsigned wait_nr, unsigned flags);
+
+    int m_fd;
+
+    void* m_sq_ring;
+    size_t m_sq_ring_size;
+    void* m_cq_ring;
+    size_t m_cq_ring_size;
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sqe_tail; // sqes taken, published to *m_sq_tail on submit
+
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe* m_cqes;
+
+    io_uring_buf_ring* m_buf_ring;
+    size_t m_buf_ring_size;
+    char* m_buffers;
+    unsigned m_buffer_size;
+    unsigned m_buffer_count;
+    unsigned short m_buf_tail;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,643 @@
+#include "uring_reactor.h"
+
+#ifdef USE_IO_URING
+
+#include <cassert>
+#include <poll.h>
+
+Uring_reactor::Uring_reactor(int id, Conn_table* users, Conn_pool* pool):
+    m_id(id), m_listenfd(-1), m_sigfd(-1), m_inotifyfd(-1), m_eventfd(-1), m_spare_fd(-1), users(users), m_pool(pool),
+    m_timeout_armed(false), m_timeout_expire(0), m_stop(false)
+{
+}
+
+Uring_reactor::~Uring_reactor()
+{
+    for(auto& splice : m_splices)
+    {
+        close(splice.second.pipe[0]);
+        close(splice.second.pipe[1]);
+    }
+    close(m_listenfd);
+    close(m_eventfd);
+    if(m_spare_fd >= 0)
+    {
+        close(m_spare_fd);
+    }
+    if(m_sigfd >= 0)
+    {
+        close(m_sigfd);
+    }
+}
+
+void Uring_reactor::event_listen(int port)
+{
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(m_listenfd  >= 0);
+
+    int reuse = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // every reactor binds its own listen socket to the same port
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    int ret = bind(m_listenfd, (struct sockaddr*)&address, sizeof(address));
+    assert(ret >= 0);
+
+    ret = listen(m_listenfd, SOMAXCONN);
+    assert(ret >= 0);
+    m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    m_eventfd = eventfd(0, 0);
+    assert(m_eventfd >= 0);
+
+    if(m_id == 0)
+    {
+        sigset_t mask;
+        handled_signals(&mask);
+        m_sigfd = signalfd(-1, &mask, 0);
+        assert(m_sigfd >= 0);
+
+        m_inotifyfd = File_cache::get_instance()->inotify_fd();
+    }
+}
+
+void Uring_reactor::stop()
+{
+    m_stop = true;
+    uint64_t one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+}
+
+/* only the first entry of an empty list wakes the reactor up: the ones after it are
+ * drained along with it, since the reactor takes the list after reading the eventfd */
+void Uring_reactor::rearm(int fd, unsigned generation, int ev)
+{
+    m_handback_lock.lock();
+    bool wake = m_handbacks.empty();
+    m_handbacks.push_back(Handback_entry{fd, generation, ev});
+    m_handback_lock.unlock();
+    if(wake)
+    {
+        uint64_t one = 1;
+        ::write(m_eventfd, &one, sizeof(one));
+    }
+}
+
+io_uring_sqe* Uring_reactor::sqe(int opcode, int fd, uint64_t user_data)
+{
+    io_uring_sqe* sqe = m_ring.get_sqe();
+    assert(sqe);
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+void Uring_reactor::arm_accept()
+{
+    // the sockets are made nonblocking, so a splice to a full one returns instead of blocking an io-wq thread
+    io_uring_sqe* s = sqe(IORING_OP_ACCEPT, m_listenfd, tag(OP_ACCEPT));
+    s->ioprio = IORING_ACCEPT_MULTISHOT;
+    s->accept_flags = SOCK_NONBLOCK;
+}
+
+void Uring_reactor::arm_event()
+{
+    io_uring_sqe* s = sqe(IORING_OP_READ, m_eventfd, tag(OP_EVENT));
+    s->addr = (unsigned long)&m_event_value;
+    s->len = sizeof(m_event_value);
+    s->off = -1;
+}
+
+void Uring_reactor::arm_signal()
+{
+    io_uring_sqe* s = sqe(IORING_OP_READ, m_sigfd, tag(OP_SIGNAL));
+    s->addr = (unsigned long)m_signals;
+    s->len = sizeof(m_signals);
+    s->off = -1;
+}
+
+void Uring_reactor::arm_inotify()
+{
+    io_uring_sqe* s = sqe(IORING_OP_POLL_ADD, m_inotifyfd, tag(OP_INOTIFY));
+    s->poll32_events = POLLIN;
+    s->len = IORING_POLL_ADD_MULTI;
+}
+
+/* the wheel is only looked at again when the next tick is due, as with epoll_wait. a
+ * timer due sooner than the armed timeout moves it up, or it would fire up to a whole
+ * round of the wheel late */
+void Uring_reactor::arm_timeout()
+{
+    int timeout = timer_wheel.next_timeout();
+    if(timeout < 0)
+    {
+        return;
+    }
+    time_t expire = now_ms() + timeout;
+    if(m_timeout_armed && expire >= m_timeout_expire)
+    {
+        return;
+    }
+    m_timeout.tv_sec = timeout / 1000;
+    m_timeout.tv_nsec = (long long)(timeout % 1000) * 1000000;
+    m_timeout_expire = expire;
+
+    if(m_timeout_armed)
+    {
+        // fails with -ENOENT if it has just fired, its completion then re-arms it
+        io_uring_sqe* s = sqe(IORING_OP_TIMEOUT_REMOVE, -1, tag(OP_TIMEOUT_UPDATE));
+        s->addr = tag(OP_TIMEOUT);
+        s->addr2 = (unsigned long)&m_timeout;
+        s->timeout_flags = IORING_TIMEOUT_UPDATE;
+        s->flags = IOSQE_CQE_SKIP_SUCCESS;
+        return;
+    }
+    io_uring_sqe* s = sqe(IORING_OP_TIMEOUT, -1, tag(OP_TIMEOUT));
+    s->addr = (unsigned long)&m_timeout;
+    s->len = 1;
+    m_timeout_armed = true;
+}
+
+// the kernel picks a buffer of the ring once the bytes arrive, so an idle connection holds none
+void Uring_reactor::arm_recv(http_conn& conn)
+{
+    io_uring_sqe* s = sqe(IORING_OP_RECV, conn.m_sockfd, tag(OP_RECV, conn.m_sockfd, conn.m_generation));
+    s->flags = IOSQE_BUFFER_SELECT;
+    s->buf_group = BUFFER_GROUP;
+}
+
+/* the next piece of the response: the iovecs by writev, or for a file sent without
+ * mapping it, the headers by send then the body moved from the page cache into a pipe
+ * and from the pipe into the socket, which is what sendfile does in one call */
+void Uring_reactor::send_next(http_conn& conn)
+{
+    int fd = conn.m_sockfd;
+    uint64_t generation = conn.m_generation;
+    if(!conn.m_sendfile)
+    {
+        io_uring_sqe* s = sqe(IORING_OP_WRITEV, fd, tag(OP_SEND, fd, generation));
+        s->addr = (unsigned long)(conn.m_iv + conn.m_iv_first);
+        s->len = conn.m_iv_count - conn.m_iv_first;
+        return;
+    }
+    if(conn.bytes_have_send < conn.m_write_idx)
+    {
+        // MSG_MORE holds the headers back, so they share a segment with the body
+        io_uring_sqe* s = sqe(IORING_OP_SEND, fd, tag(OP_SEND, fd, generation));
+        s->addr = (unsigned long)(conn.m_write_buf.data() + conn.bytes_have_send);
+        s->len = conn.m_write_idx - conn.bytes_have_send;
+        s->msg_flags = MSG_MORE | MSG_NOSIGNAL;
+        return;
+    }
+
+    auto it = m_splices.find(fd);
+    if(it == m_splices.end())
+    {
+        Splice splice;
+        if(pipe(splice.pipe) < 0)
+        {
+            close_conn(fd);
+            return;
+        }
+        splice.piped = 0;
+        it = m_splices.emplace(fd, splice).first;
+    }
+    Splice& splice = it->second;
+    if(splice.piped == 0)
+    {
+        off_t left = conn.bytes_to_send;
+        io_uring_sqe* s = sqe(IORING_OP_SPLICE, splice.pipe[1], tag(OP_SPLICE_IN, fd, generation));
+        s->splice_fd_in = conn.m_file->fd;
+        s->splice_off_in = conn.m_file_offset;
+        s->off = -1;
+        s->len = left < (off_t)SPLICE_CHUNK ? left : SPLICE_CHUNK;
+    }
+    else
+    {
+        io_uring_sqe* s = sqe(IORING_OP_SPLICE, fd, tag(OP_SPLICE_OUT, fd, generation));
+        s->splice_fd_in = splice.pipe[0];
+        s->splice_off_in = -1;
+        s->off = -1;
+        s->len = splice.piped;
+    }
+}
+
+void Uring_reactor::end_splice(int sockfd)
+{
+    auto it = m_splices.find(sockfd);
+    if(it != m_splices.end())
+    {
+        close(it->second.pipe[0]);
+        close(it->second.pipe[1]);
+        m_splices.erase(it);
+    }
+}
+
+/* the operations still pending on the fd are cancelled before it is closed, the ring
+ * holds a reference to the socket until then. their completions carry the generation
+ * of this connection, so they are told apart from the ones of the next on the same fd */
+void Uring_reactor::close_conn(int sockfd)
+{
+    // a worker is still using the connection: only shut it down, as the epoll reactor does
+    if(user(sockfd).m_busy)
+    {
+        shutdown(sockfd, SHUT_RDWR);
+        return;
+    }
+    timer_wheel.del_timer(&user(sockfd).m_timer);
+    end_splice(sockfd);
+    user(sockfd).close_conn();
+
+    io_uring_sqe* cancel = sqe(IORING_OP_ASYNC_CANCEL, sockfd, tag(OP_CLOSE));
+    cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    cancel->flags = IOSQE_IO_HARDLINK | IOSQE_CQE_SKIP_SUCCESS;
+    io_uring_sqe* close = sqe(IORING_OP_CLOSE, sockfd, tag(OP_CLOSE));
+    close->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+void Uring_reactor::reject(int sockfd)
+{
+    send_overload(sockfd);
+    close_conn(sockfd);
+}
+
+// hand a connection with a request in its read buffer to the pool
+void Uring_reactor::dispatch(int sockfd)
+{
+    user(sockfd).m_busy = true;
+    if(!m_pool->append(&user(sockfd), m_id))
+    {
+        user(sockfd).m_busy = false;
+        reject(sockfd);
+    }
+}
+
+void Uring_reactor::handle_accept(int res, unsigned flags)
+{
+    // the multishot accept ends on an error, or when the kernel can't keep it going
+    if(!(flags & IORING_CQE_F_MORE))
+    {
+        arm_accept();
+    }
+    if(res == -EMFILE || res == -ENFILE)
+    {
+        shed_backlog(m_listenfd, m_spare_fd);
+    }
+    if(res < 0)
+    {
+        return;
+    }
+    // users is indexed by fd, so a larger one is refused whatever the count says
+    if(res >= MAX_FD || http_conn::m_user_count + 4 >= MAX_FD)
+    {
+        ::close(res);
+        return;
+    }
+
+    // a multishot accept reports no address, and the connection never looks at it
+    struct sockaddr_in client_address;
+    bzero(&client_address, sizeof(client_address));
+    http_conn* conn = users->get(res);
+    conn->init(res, client_address, -1, this);
+    timer_wheel.schedule(&conn->m_timer, conn->deadline());
+    arm_recv(*conn);
+}
+
+void Uring_reactor::handle_recv(http_conn& conn, int res, unsigned flags)
+{
+    int fd = conn.m_sockfd;
+    if(res == -ENOBUFS)
+    {
+        // every buffer is lent out, they are back once this round of completions is handled
+        arm_recv(conn);
+        return;
+    }
+    if(res <= 0)
+    {
+        close_conn(fd);
+        return;
+    }
+
+    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    bool ok = conn.received(m_ring.buffer(bid), res);
+    m_ring.recycle_buffer(bid);
+    if(!ok)
+    {
+        close_conn(fd);
+        return;
+    }
+    timer_wheel.schedule(&conn.m_timer, conn.deadline());
+
+    // more is waiting in the socket, take it before bothering a worker
+    if(flags & IORING_CQE_F_SOCK_NONEMPTY)
+    {
+        arm_recv(conn);
+        return;
+    }
+    dispatch(fd);
+}
+
+void Uring_reactor::handle_send(http_conn& conn, OP op, int res)
+{
+    int fd = conn.m_sockfd;
+    if(res == -EAGAIN)
+    {
+        // only a splice into a full socket gets here, the other sends wait in the ring
+        io_uring_sqe* s = sqe(IORING_OP_POLL_ADD, fd, tag(OP_POLL_OUT, fd, conn.m_generation));
+        s->poll32_events = POLLOUT;
+        return;
+    }
+    if(res < 0)
+    {
+        close_conn(fd);
+        return;
+    }
+
+    if(op == OP_SPLICE_IN)
+    {
+        // the file has shrunk under us
+        if(res == 0)
+        {
+            close_conn(fd);
+            return;
+        }
+        m_splices[fd].piped += res;
+        conn.m_file_offset += res;
+        send_next(conn);
+        return;
+    }
+    if(op == OP_SPLICE_OUT)
+    {
+        m_splices[fd].piped -= res;
+    }
+
+    switch(conn.sent(res))
+    {
+        case http_conn::SEND_MORE:
+            {
+                timer_wheel.schedule(&conn.m_timer, conn.deadline());
+                send_next(conn);
+                break;
+            }
+        case http_conn::SEND_DONE:
+            {
+                end_splice(fd);
+                timer_wheel.schedule(&conn.m_timer, conn.deadline());
+                if(conn.take_pipelined())
+                {
+                    dispatch(fd);
+                }
+                else
+                {
+                    arm_recv(conn);
+                }
+                break;
+            }
+        case http_conn::SEND_CLOSE:
+            {
+                close_conn(fd);
+                break;
+            }
+    }
+}
+
+// the connections the workers are done with: EPOLLIN for more of the request, EPOLLOUT for a response
+void Uring_reactor::handle_handbacks()
+{
+    m_handback_lock.lock();
+    m_draining.swap(m_handbacks);
+    m_handback_lock.unlock();
+
+    for(const Handback_entry& entry : m_draining)
+    {
+        http_conn* conn = users->find(entry.fd);
+        if(!conn || conn->m_generation != entry.generation || conn->m_sockfd < 0)
+        {
+            continue;
+        }
+        if(entry.ev & EPOLLOUT)
+        {
+            timer_wheel.schedule(&conn->m_timer, conn->deadline());
+            if(conn->bytes_to_send == 0)
+            {
+                // empty http-response, usually it won't happen
+                conn->init();
+                if(conn->take_pipelined())
+                {
+                    dispatch(entry.fd);
+                }
+                else
+                {
+                    arm_recv(*conn);
+                }
+            }
+            else
+            {
+                send_next(*conn);
+            }
+        }
+        else
+        {
+            arm_recv(*conn);
+        }
+    }
+    m_draining.clear();
+}
+
+bool Uring_reactor::handle_signal()
+{
+    for(size_t i = 0; i < sizeof(m_signals) / sizeof(m_signals[0]); i++)
+    {
+        if(m_signals[i].ssi_signo == SIGTERM)
+        {
+            for(Uring_reactor* peer : m_peers)
+            {
+                peer->stop();
+            }
+            return true;
+        }
+        if(m_signals[i].ssi_signo == SIGUSR1)
+        {
+            print_stats(m_pool);
+        }
+    }
+    return false;
+}
+
+/* a connection is only closed when the deadline of its current phase has passed, and
+ * then only shut down: its pending operation, or the one armed by the handback of a
+ * worker finishing with it, fails and closes it. see Reactor::handle_timeout */
+void Uring_reactor::handle_timeout()
+{
+    m_expired.clear();
+    timer_wheel.tick(m_expired);
+
+    time_t cur = now_ms();
+    for(Timer* timer : m_expired)
+    {
+        http_conn* user = timer->user;
+        if(user->m_busy)
+        {
+            timer_wheel.schedule(timer, cur + http_conn::m_write_timeout);
+        }
+        else if(user->deadline() > cur)
+        {
+            timer_wheel.schedule(timer, user->deadline());
+        }
+        else
+        {
+            shutdown(user->sockfd(), SHUT_RDWR);
+        }
+    }
+}
+
+void Uring_reactor::handle_completion(const io_uring_cqe& cqe, bool& stop_server)
+{
+    OP op = (OP)((cqe.user_data >> 24) & 0xff);
+    int fd = cqe.user_data & 0xffffff;
+    unsigned generation = cqe.user_data >> 32;
+
+    switch(op)
+    {
+        case OP_ACCEPT:
+            {
+                handle_accept(cqe.res, cqe.flags);
+                return;
+            }
+        case OP_EVENT:
+            {
+                if(m_stop)
+                {
+                    stop_server = true;
+                    return;
+                }
+                arm_event();
+                handle_handbacks();
+                return;
+            }
+        case OP_SIGNAL:
+            {
+                if(cqe.res > 0)
+                {
+                    memset((char*)m_signals + cqe.res, 0, sizeof(m_signals) - cqe.res);
+                    if(handle_signal())
+                    {
+                        stop_server = true;
+                        return;
+                    }
+                }
+                arm_signal();
+                return;
+            }
+        case OP_INOTIFY:
+            {
+                File_cache::get_instance()->handle_inotify();
+                if(!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    arm_inotify();
+                }
+                return;
+            }
+        case OP_TIMEOUT:
+            {
+                m_timeout_armed = false;
+                return;
+            }
+        case OP_TIMEOUT_UPDATE:
+        case OP_CLOSE:
+            {
+                return;
+            }
+        default:
+            break;
+    }
+
+    // a completion of a connection closed since, only its buffer matters still
+    http_conn* conn = users->find(fd);
+    if(!conn || conn->m_generation != generation || conn->m_sockfd < 0)
+    {
+        if(cqe.flags & IORING_CQE_F_BUFFER)
+        {
+            m_ring.recycle_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        return;
+    }
+
+    switch(op)
+    {
+        case OP_RECV:
+            {
+                handle_recv(*conn, cqe.res, cqe.flags);
+                break;
+            }
+        case OP_POLL_OUT:
+            {
+                if(cqe.res < 0)
+                {
+                    close_conn(fd);
+                }
+                else
+                {
+                    send_next(*conn);
+                }
+                break;
+            }
+        default:
+            {
+                handle_send(*conn, op, cqe.res);
+                break;
+            }
+    }
+}
+
+/* the ring is set up here, on the thread of the loop: it is the only one allowed to
+ * submit, see Uring::init */
+void Uring_reactor::event_loop()
+{
+    // before the ring and its buffers are allocated, so they are local to the cpus
+    pin_thread(m_id % m_pool->groups(), m_pool->groups());
+    bool ok = m_ring.init(RING_ENTRIES) && m_ring.setup_buffers(BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE);
+    assert(ok);
+    if(!ok)
+    {
+        return;
+    }
+
+    arm_accept();
+    arm_event();
+    if(m_sigfd >= 0)
+    {
+        arm_signal();
+    }
+    if(m_inotifyfd >= 0)
+    {
+        arm_inotify();
+    }
+
+    bool stop_server = false;
+    while(!stop_server)
+    {
+        arm_timeout();
+        m_ring.submit_and_wait(1);
+
+        io_uring_cqe* cqe;
+        while(!stop_server && (cqe = m_ring.peek_cqe()))
+        {
+            io_uring_cqe copy = *cqe;
+            m_ring.cqe_seen();
+            handle_completion(copy, stop_server);
+        }
+
+        handle_timeout();
+    }
+}
+
+#endif
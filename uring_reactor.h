@@ -0,0 +1,125 @@
+#pragma once
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#ifdef USE_IO_URING
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <unordered_map>
+#include <vector>
+#include "http_conn.h"
+#include "conn_table.h"
+#include "reactor.h"
+#include "timer.h"
+#include "uring.h"
+
+/* the event loop of Reactor, driven by io_uring instead of epoll: connections come from
+ * a multishot accept, requests are received into the buffers of a provided buffer ring,
+ * responses go out by writev, and files too large to map by splice through a pipe, the
+ * timing wheel ticks on a ring timeout. a request is processed by the pool as with epoll,
+ * and the worker hands the connection back through rearm() instead of modfd() */
+class Uring_reactor: public Handback
+{
+public:
+    Uring_reactor(int id, Conn_table* users, Conn_pool* pool);
+    ~Uring_reactor();
+
+    void event_listen(int port);
+    void event_loop();
+
+    // wake this reactor up from another thread and make it quit
+    void stop();
+
+    // called by the workers and the db thread, see http_conn::rearm()
+    void rearm(int fd, unsigned generation, int ev) override;
+
+    // reactor 0 receives the signals and stops the others
+    std::vector<Uring_reactor*> m_peers;
+
+private:
+    // what a completion is for, kept in its user_data with the fd and the generation
+    enum OP {OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_SPLICE_IN, OP_SPLICE_OUT, OP_POLL_OUT,
+             OP_EVENT, OP_SIGNAL, OP_INOTIFY, OP_TIMEOUT, OP_TIMEOUT_UPDATE, OP_CLOSE};
+
+    static const unsigned RING_ENTRIES = 4096;
+    static const int BUFFER_GROUP = 0;
+    static const unsigned BUFFER_COUNT = 1024;
+    static const unsigned BUFFER_SIZE = 4096;
+    static const unsigned SPLICE_CHUNK = 64 << 10;
+
+    static uint64_t tag(OP op, int fd = 0, unsigned generation = 0)
+    {
+        return (uint64_t)generation << 32 | (uint64_t)op << 24 | (uint32_t)fd;
+    }
+
+    io_uring_sqe* sqe(int opcode, int fd, uint64_t user_data);
+
+    void arm_accept();
+    void arm_event();
+    void arm_signal();
+    void arm_inotify();
+    void arm_timeout();
+    void arm_recv(http_conn& conn);
+    void send_next(http_conn& conn);
+
+    void handle_completion(const io_uring_cqe& cqe, bool& stop_server);
+    void handle_accept(int res, unsigned flags);
+    void handle_recv(http_conn& conn, int res, unsigned flags);
+    void handle_send(http_conn& conn, OP op, int res);
+    void handle_handbacks();
+    bool handle_signal();
+    void handle_timeout();
+
+    void close_conn(int sockfd);
+    void reject(int sockfd);
+    void dispatch(int sockfd);
+
+    int m_id;
+    int m_listenfd;
+    int m_sigfd; // signalfd, reactor 0 only
+    int m_inotifyfd; // inotify of the file cache, reactor 0 only
+    int m_eventfd; // written by stop() and rearm()
+    int m_spare_fd; // given up to accept when the fds run out, see shed_backlog
+    Conn_table *users; // shared by all the reactors, indexed by fd
+    Conn_pool *m_pool;
+
+    // the connection of an fd accepted by this reactor
+    http_conn& user(int sockfd) {return *users->find(sockfd);}
+
+    Uring m_ring;
+    bool m_timeout_armed;
+    time_t m_timeout_expire; // when the armed timeout fires, see now_ms()
+    struct __kernel_timespec m_timeout;
+    uint64_t m_event_value;
+    struct signalfd_siginfo m_signals[16];
+
+    // connections handed back by other threads, drained on the eventfd
+    struct Handback_entry
+    {
+        int fd;
+        unsigned generation;
+        int ev;
+    };
+    Locker m_handback_lock;
+    std::vector<Handback_entry> m_handbacks;
+    std::vector<Handback_entry> m_draining;
+    std::atomic<bool> m_stop;
+
+    // the pipe of a file body being spliced, and the bytes of it still in the pipe
+    struct Splice
+    {
+        int pipe[2];
+        size_t piped;
+    };
+    std::unordered_map<int, Splice> m_splices;
+    void end_splice(int sockfd);
+
+    Timer_wheel timer_wheel;
+    std::vector<Timer*> m_expired;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,363 @@
+#include "user_store.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+
+const char SNAPSHOT_MAGIC[8] = {'T', 'S', 'U', 'S', 'E', 'R', 'S', '1'};
+
+/* the sections are only valid for the std::hash which placed the users in the shards,
+ * so the header keeps the hash of a fixed name to tell another library's */
+uint64_t hash_check()
+{
+    return std::hash<std::string>()("toyserver users");
+}
+
+template<int SHARDS>
+struct Snapshot_header
+{
+    char magic[8];
+    uint64_t hash;
+    uint64_t shards;
+    uint64_t offset[SHARDS]; // of the section of each shard, from the start of the file
+    uint64_t bytes[SHARDS];
+    uint64_t count[SHARDS];
+};
+
+// a record is the two lengths followed by the name and the password
+struct Record_header
+{
+    uint16_t username_len;
+    uint16_t password_len;
+};
+
+bool write_all(int fd, const char* data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+}
+
+User_store::Shard& User_store::shard(const std::string& username)
+{
+    return m_shards[std::hash<std::string>()(username) % SHARDS];
+}
+
+bool User_store::insert(const std::string& username, const std::string& password)
+{
+    Shard& s = shard(username);
+    s.lock.wrlock();
+    bool inserted = s.users.emplace(username, Entry{password, m_generation}).second;
+    s.lock.unlock();
+    return inserted;
+}
+
+void User_store::erase(const std::string& username)
+{
+    Shard& s = shard(username);
+    s.lock.wrlock();
+    s.users.erase(username);
+    s.lock.unlock();
+}
+
+bool User_store::contains(const std::string& username)
+{
+    Shard& s = shard(username);
+    s.lock.rdlock();
+    bool found = s.users.count(username) != 0;
+    s.lock.unlock();
+    return found;
+}
+
+bool User_store::check(const std::string& username, const std::string& password)
+{
+    Shard& s = shard(username);
+    s.lock.rdlock();
+    auto it = s.users.find(username);
+    bool ok = it != s.users.end() && it->second.password == password;
+    s.lock.unlock();
+    return ok;
+}
+
+size_t User_store::size()
+{
+    size_t n = 0;
+    for(Shard& s : m_shards)
+    {
+        s.lock.rdlock();
+        n += s.users.size();
+        s.lock.unlock();
+    }
+    return n;
+}
+
+void User_store::reserve(size_t n)
+{
+    for(Shard& s : m_shards)
+    {
+        s.lock.wrlock();
+        s.users.reserve(n / SHARDS + 1);
+        s.lock.unlock();
+    }
+}
+
+void User_store::begin_sync()
+{
+    ++m_generation;
+}
+
+void User_store::sync(const char* username, size_t username_len, const char* password, size_t password_len)
+{
+    std::string name(username, username_len);
+    Shard& s = shard(name);
+    s.lock.wrlock();
+    Entry& entry = s.users[name];
+    entry.password.assign(password, password_len);
+    entry.generation = m_generation;
+    s.lock.unlock();
+}
+
+size_t User_store::end_sync()
+{
+    unsigned generation = m_generation;
+    size_t dropped = 0;
+    for(Shard& s : m_shards)
+    {
+        s.lock.wrlock();
+        for(auto it = s.users.begin(); it != s.users.end(); )
+        {
+            if(it->second.generation != generation)
+            {
+                it = s.users.erase(it);
+                ++dropped;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        s.lock.unlock();
+    }
+    return dropped;
+}
+
+namespace
+{
+
+struct Load_job
+{
+    User_store* store;
+    const char* data;
+    size_t size;
+    int first;
+    int step;
+    bool ok;
+};
+
+}
+
+void* User_store::load_work(void* arg)
+{
+    Load_job* job = (Load_job*)arg;
+    job->ok = job->store->load_shards(job->data, job->size, job->first, job->step);
+    return job;
+}
+
+// shards first, first + step, ... of the snapshot, the other threads take the others
+bool User_store::load_shards(const char* data, size_t size, int first, int step)
+{
+    const Snapshot_header<SHARDS>* header = (const Snapshot_header<SHARDS>*)data;
+    unsigned generation = m_generation;
+
+    for(int i = first; i < SHARDS; i += step)
+    {
+        uint64_t offset = header->offset[i];
+        uint64_t bytes = header->bytes[i];
+        if(offset < sizeof(*header) || offset > size || bytes > size - offset)
+        {
+            return false;
+        }
+        const char* p = data + offset;
+        const char* end = p + bytes;
+
+        Shard& s = m_shards[i];
+        s.lock.wrlock();
+        s.users.reserve(header->count[i]);
+        for(uint64_t n = 0; n < header->count[i]; n++)
+        {
+            Record_header record;
+            if(end - p < (ptrdiff_t)sizeof(record))
+            {
+                s.lock.unlock();
+                return false;
+            }
+            memcpy(&record, p, sizeof(record));
+            p += sizeof(record);
+            if(end - p < record.username_len + record.password_len)
+            {
+                s.lock.unlock();
+                return false;
+            }
+            s.users.emplace(std::piecewise_construct,
+                            std::forward_as_tuple(p, record.username_len),
+                            std::forward_as_tuple(Entry{std::string(p + record.username_len, record.password_len), generation}));
+            p += record.username_len + record.password_len;
+        }
+        s.lock.unlock();
+    }
+    return true;
+}
+
+bool User_store::load(const char* path, int threads)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Snapshot_header<SHARDS>))
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(map, size, MADV_WILLNEED);
+
+    const char* data = (const char*)map;
+    const Snapshot_header<SHARDS>* header = (const Snapshot_header<SHARDS>*)data;
+    bool ok = memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0
+              && header->hash == hash_check() && header->shards == SHARDS;
+
+    if(ok)
+    {
+        threads = threads < 1 ? 1 : threads > SHARDS ? SHARDS : threads;
+        std::vector<Load_job> jobs(threads);
+        std::vector<pthread_t> tids(threads);
+        for(int i = 0; i < threads; i++)
+        {
+            jobs[i] = Load_job{this, data, size, i, threads, false};
+        }
+        // the calling thread loads the first share itself
+        int started = 1;
+        for(; started < threads; started++)
+        {
+            if(pthread_create(&tids[started], NULL, load_work, &jobs[started]) != 0)
+            {
+                break;
+            }
+        }
+        for(int i = started; i < threads; i++)
+        {
+            load_work(&jobs[i]);
+        }
+        load_work(&jobs[0]);
+        for(int i = 1; i < started; i++)
+        {
+            pthread_join(tids[i], NULL);
+        }
+        for(const Load_job& job : jobs)
+        {
+            ok = ok && job.ok;
+        }
+    }
+    munmap(map, size);
+
+    if(!ok)
+    {
+        for(Shard& s : m_shards)
+        {
+            s.lock.wrlock();
+            s.users.clear();
+            s.lock.unlock();
+        }
+    }
+    return ok;
+}
+
+bool User_store::save(const char* path)
+{
+    std::string tmp = std::string(path) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    Snapshot_header<SHARDS> header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.hash = hash_check();
+    header.shards = SHARDS;
+
+    // the header is written last, once the sections are known
+    bool ok = lseek(fd, sizeof(header), SEEK_SET) == (off_t)sizeof(header);
+    uint64_t offset = sizeof(header);
+    std::string section;
+    for(int i = 0; ok && i < SHARDS; i++)
+    {
+        section.clear();
+        uint64_t count = 0;
+        Shard& s = m_shards[i];
+        s.lock.rdlock();
+        for(const auto& user : s.users)
+        {
+            const std::string& password = user.second.password;
+            if(user.first.size() > UINT16_MAX || password.size() > UINT16_MAX)
+            {
+                continue;
+            }
+            Record_header record = {(uint16_t)user.first.size(), (uint16_t)password.size()};
+            section.append((const char*)&record, sizeof(record));
+            section.append(user.first);
+            section.append(password);
+            ++count;
+        }
+        s.lock.unlock();
+
+        header.offset[i] = offset;
+        header.bytes[i] = section.size();
+        header.count[i] = count;
+        offset += section.size();
+        ok = write_all(fd, section.data(), section.size());
+    }
+
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    ok = ok && rename(tmp.c_str(), path) == 0;
+    if(!ok)
+    {
+        unlink(tmp.c_str());
+    }
+    return ok;
+}
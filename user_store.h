@@ -0,0 +1,76 @@
+#pragma once
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "locker.h"
+
+/* username -> password, shared by all the worker threads. the users are spread over
+ * SHARDS buckets by the hash of their name, each with its own reader/writer lock,
+ * so logins of different users never touch the same lock, and only a registration
+ * blocks the logins hashed to its own shard */
+class User_store
+{
+public:
+    User_store(): m_generation(0) {}
+
+    // add a user, false if the name is taken. the check and the insertion are atomic
+    bool insert(const std::string& username, const std::string& password);
+
+    // give a name back, when its registration has failed
+    void erase(const std::string& username);
+
+    bool contains(const std::string& username);
+
+    // true if the user exists with this password
+    bool check(const std::string& username, const std::string& password);
+
+    size_t size();
+
+    // make room for about n users, before a bulk load
+    void reserve(size_t n);
+
+    /* reconcile the store with the user table streamed from mysql: begin_sync() starts a
+     * generation, sync() adds or updates each row of the table, and end_sync() drops the
+     * users the table no longer has. the users inserted meanwhile belong to the new
+     * generation, so a registration not written yet survives */
+    void begin_sync();
+    void sync(const char* username, size_t username_len, const char* password, size_t password_len);
+    size_t end_sync(); // number of users dropped
+
+    /* a snapshot is a file with a section per shard, so threads threads load it in
+     * parallel from one read only mapping, each into shards of its own. false if
+     * there is no snapshot or it doesn't match this build, and the store stays empty */
+    bool load(const char* path, int threads);
+
+    // written to path.tmp and renamed, so a crash never leaves half a snapshot
+    bool save(const char* path);
+
+private:
+    static const int SHARDS = 64;
+
+    struct Entry
+    {
+        std::string password;
+        unsigned generation;
+    };
+
+    // a shard per cache line, so the lock word of one doesn't bounce with its neighbours
+    struct alignas(64) Shard
+    {
+        Rwlock lock;
+        std::unordered_map<std::string, Entry> users;
+    };
+
+    Shard& shard(const std::string& username);
+
+    static void* load_work(void* arg);
+    bool load_shards(const char* data, size_t size, int first, int step);
+
+    Shard m_shards[SHARDS];
+    std::atomic<unsigned> m_generation;
+};
+
+#endif
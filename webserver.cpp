@@ -1,262 +1,95 @@
 #include "webserver.h"
-#include <cassert>
 
-static int *pipefd;
-
-void addsig(int sig, void(handler)(int), bool restart = true)
+WebServer::WebServer(): m_user_syncing(false)
 {
-    struct sigaction sa;
-    memset(&sa, 0x00, sizeof(sa));
-    sa.sa_handler = handler;
-    if(restart)
-    {
-        sa.sa_flags |= SA_RESTART;
-    }
-    sigfillset(&sa.sa_mask);
-    int ret = sigaction(sig, &sa, NULL);
-    assert(ret >= 0);
+    users = new Conn_table(MAX_FD);
 }
 
-void sig_handler(int sig)
+WebServer::~WebServer()
 {
-    int save_errno = errno;
-    int msg = sig;
-    send(pipefd[1], (char*)&msg, 1, 0);
-    errno = save_errno;
-}
+    if(m_user_syncing)
+    {
+        pthread_join(m_user_sync, NULL);
+    }
 
-WebServer::WebServer():timer_heap(-1)
-{
-    users = new http_conn[MAX_FD];
-    timer_arr.resize(MAX_FD);
-}
+    // its last callbacks still reach the connections and the epoll of their reactor
+    delete http_conn::m_db;
 
-WebServer::~WebServer()
-{
-    close(m_epollfd);
-    close(m_listenfd);
-    close(m_pipefd[1]);
-    close(m_pipefd[0]);
-    delete [] users;
+    // every registration is settled now, the next start loads them from here
+    if(user_snapshot)
+    {
+        http_conn::user_info.save(user_snapshot);
+    }
+    for(Event_loop* reactor : m_reactors)
+    {
+        delete reactor;
+    }
+    delete users;
     delete m_pool;
 }
 
-void WebServer::init(int port, int thread_num)
+void WebServer::init(int port, int thread_num, int reactor_num)
 {
     m_port = port;
     m_thread_num = thread_num;
+    m_reactor_num = reactor_num > 0 ? reactor_num : 1;
 
-    m_pool = new Threadpool<http_conn>(m_thread_num, 20000);
-    init_user_info();
-}
+    // the worker threads inherit the signal mask
+    block_signals();
 
-void WebServer::event_listen()
-{
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd  >= 0);
-
-    struct linger tmp = {1,0};
-    setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
-
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(m_port);
-
-    int ret = bind(m_listenfd, (struct sockaddr*)&address, sizeof(address));
-    assert(ret >= 0);
-   
-    ret = listen(m_listenfd, 10);
-    assert(ret >= 0);
-
-    m_epollfd= epoll_create(5);
-    assert(m_epollfd >= 0);
-    http_conn::m_epollfd = m_epollfd;
-    addfd(m_epollfd, m_listenfd, false);
-
-    timer_heap.epollfd = m_epollfd;
-
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-    assert(ret >= 0);
-    pipefd = m_pipefd;
-    set_nonblocking(m_pipefd[1]);
-    addfd(m_epollfd, m_pipefd[0],false);
-
-    addsig(SIGPIPE, SIG_IGN);
-    addsig(SIGALRM, sig_handler);
-    addsig(SIGTERM, sig_handler);
-}
-
-void WebServer::timer(int connfd, const sockaddr_in& client_address)
-{
-    users[connfd].init(connfd, client_address);
-
-    Timer* timer = new Timer(3*TIMESLOT);
-    timer->sockfd = connfd;
-    timer_heap.add_timer(timer);
-    timer_arr[connfd] = timer;
-}
-
-bool WebServer::handle_newclient()
-{
-    struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
-    int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength);
-    if(connfd < 0)
+    m_pool = new Conn_pool(m_thread_num, 20000, m_reactor_num);
+    File_cache::get_instance()->init(doc_root, 64 << 20, http_conn::m_sendfile_threshold);
+    File_cache::get_instance()->preload(doc_root, 64 << 20);
+    /* from a snapshot the listener opens right away, and the users which changed in
+     * mysql since it was saved are brought up to date in the background */
+    if(init_user_info())
     {
-        return false;
+        m_user_syncing = pthread_create(&m_user_sync, NULL, sync_user_info, NULL) == 0;
     }
 
-    if(http_conn::m_user_count + 4 >= MAX_FD)
-    {
-        return false;
-    }
-
-    timer(connfd, client_address);
-    //printf("---new client initialized---\n");
-    return true;
+    // its writer thread takes a pooled connection per batch
+    http_conn::m_db = new Db_executor(http_conn::m_connpool);
 }
 
-bool WebServer::handle_signal(bool &timeout, bool &stop_server)
+void WebServer::event_listen()
 {
-    char signals[1024];
-    int ret = recv(m_pipefd[0], signals, sizeof(signals), 0);
-    if(ret <= 0)
-    {
-        return false;
-    }
-    else
+    for(int i = 0; i < m_reactor_num; i++)
     {
-        for(int i = 0; i < ret; i++)
-        {
-            switch(signals[i])
-            {
-            case SIGTERM:
-                {
-                    stop_server = true;
-                    break;
-                }
-            case SIGALRM:
-                {
-                    timeout = true;
-                    break;
-                }
-            default:
-                break;
-            }
-        }
+        Event_loop* reactor = new Event_loop(i, users, m_pool);
+        reactor->event_listen(m_port);
+        m_reactors.push_back(reactor);
     }
-    return true;
-}
 
-void WebServer:: handle_read(int sockfd)
-{
-    Timer* timer = timer_arr[sockfd];
-
-    if(users[sockfd].read())
-    {
-        m_pool->append(users+sockfd);
-        if(timer)
-        {
-            timer->expire = time(NULL) + 3*TIMESLOT;
-        }
-    }
-    else
+    for(int i = 1; i < m_reactor_num; i++)
     {
-        // it is the same as users[sockfd].close_conn();
-        timer->terminate(m_epollfd);
-        timer_heap.del_timer(timer);
+        m_reactors[0]->m_peers.push_back(m_reactors[i]);
     }
 }
 
-void WebServer::handle_write(int sockfd)
+void* WebServer::reactor_work(void* arg)
 {
-    Timer* timer = timer_arr[sockfd];
-    
-    if(users[sockfd].write())
-    {
-        //printf("---write returns true---\n");
-        if(timer)
-        {
-            timer->expire = time(NULL) + 3*TIMESLOT;
-        }
-    }
-    else
-    {
-        //printf("---write returns false---\n");
-        timer->terminate(m_epollfd);
-        timer_heap.del_timer(timer);
-    }
+    Event_loop* reactor = (Event_loop*)arg;
+    reactor->event_loop();
+    return reactor;
 }
 
 void WebServer::event_loop()
 {
-    bool timeout = false;
-    bool stop_server = false;
-
-    alarm(TIMESLOT);
-
-    while(!stop_server)
+    m_reactor_threads.resize(m_reactor_num);
+    for(int i = 1; i < m_reactor_num; i++)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
-        if(number < 0 && errno != EINTR)
+        if(pthread_create(&m_reactor_threads[i], NULL, reactor_work, m_reactors[i]) != 0)
         {
-            //printf("---epoll failure---\n");
-            break;
+            throw std::exception();
         }
+    }
 
-        for(int i = 0; i < number; i++)
-        {
-            int sockfd = events[i].data.fd;
-
-            if(sockfd == m_listenfd)
-            {
-                bool flag = handle_newclient();
-                if(!flag)
-                {
-                    //printf("---handle new client failed\n---");
-                    continue;
-                }
-            }
-            else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
-            {
-                Timer* timer = timer_arr[sockfd];
-                timer->terminate(m_epollfd);
-                timer_heap.del_timer(timer);
-            }
-            else if(sockfd == m_pipefd[0] && events[i].events & EPOLLIN)
-            {
-                //printf("---handle_signal---\n");
-                bool flag = handle_signal(timeout, stop_server);
-                if(!flag)
-                {
-                    //printf("---handle signal failed---\n");
-                }
-            }
-            else if(events[i].events & EPOLLIN)
-            {
-                handle_read(sockfd);
-                //printf("---handle_read accomplished---\n");
-            }
-            else if(events[i].events & EPOLLOUT)
-            {
-                handle_write(sockfd);
-                //printf("---handle_write accomplished---\n");
-            }
-            //printf("---stucked, line 247, webserver.cpp---\n");
-        }
-        //printf("---stucked, line 249, webserver.cpp---\n");
-        if(!timer_heap.empty())
-        {
-            timer_heap.reheap();
-        }
+    m_reactors[0]->event_loop();
 
-        if(timeout)
-        {
-            //printf("---timeout---\n");
-            timer_heap.tick();
-            timeout = false;
-        }
+    for(int i = 1; i < m_reactor_num; i++)
+    {
+        pthread_join(m_reactor_threads[i], NULL);
     }
+
+    print_stats(m_pool);
 }
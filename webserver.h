@@ -3,13 +3,18 @@
 #define WEBSERVER
 
 #include <signal.h>
+#include <vector>
 #include "http_conn.h"
 #include "threadpool.h"
-#include "timer.h"
-
-const int MAX_FD = 65536;
-const int MAX_EVENT_NUMBER = 10000;
-const time_t TIMESLOT = 5;
+#include "reactor.h"
+#include "uring_reactor.h"
+
+// the event loop is picked at build time, make server_uring builds the io_uring one
+#ifdef USE_IO_URING
+typedef Uring_reactor Event_loop;
+#else
+typedef Reactor Event_loop;
+#endif
 
 class WebServer 
 {
@@ -17,29 +22,28 @@ public:
     WebServer(); 
     ~WebServer();
 
-    void init(int port, int thread_num);
+    // reactor_num event loops share the port through SO_REUSEPORT
+    void init(int port, int thread_num, int reactor_num = 1);
     void event_listen();
     void event_loop();
-    bool handle_newclient();
-    bool handle_signal(bool &timeout, bool &stop_server);
-    void handle_read(int sockfd);
-    void handle_write(int sockfd);
-    void timer(int connfd, const struct sockaddr_in &client_address);
+
+private:
+    static void* reactor_work(void* arg); // function of the reactor threads
 
 private:
     int m_port;
-    int m_epollfd;
-    int m_pipefd[2];
-    http_conn *users; // an array 
+    Conn_table *users; // connections indexed by fd, made on demand
 
-    Threadpool<http_conn> *m_pool; // this is just a pointer, not an array
+    Conn_pool *m_pool; // this is just a pointer, not an array
     int m_thread_num;
 
-    epoll_event events[MAX_EVENT_NUMBER];
-    int m_listenfd;
+    int m_reactor_num;
+    std::vector<Event_loop*> m_reactors;
+    std::vector<pthread_t> m_reactor_threads; // reactor 0 runs in the calling thread
 
-    Timer_heap timer_heap;
-    std::vector<Timer*> timer_arr;  //an array, the index means the fd of the timer
+    // reconciles the users loaded from the snapshot with mysql, see sync_user_info()
+    pthread_t m_user_sync;
+    bool m_user_syncing;
 };
 
 #endif
@@ -0,0 +1,175 @@
+#pragma once
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+#include "mpmc_queue.h"
+
+/* scheduling policies of Threadpool, E is the type of the queued items. a policy is
+ * built from (queue_number, thread_number, max_requests) and provides
+ *   bool push(const E& item, int hint): hint is the index of the producer(the reactor)
+ *   bool pop(E& item, int worker): worker is the index of the calling thread
+ *   int capacity() const
+ *   int groups() const: the groups of workers, one per queue, see pin_thread()
+ *   int group(int worker) const */
+
+/* pin the calling thread to its share of the cpus it may run on: they are split into
+ * groups slices, and a reactor shares the slice of the workers of its queue. with one
+ * group the thread is left alone, with fewer cpus than groups the groups share cpus */
+inline void pin_thread(int group, int groups)
+{
+    cpu_set_t allowed;
+    if(groups <= 1 || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return;
+    }
+    std::vector<int> cpus;
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &allowed))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    int number = cpus.size();
+    if(number == 0)
+    {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(number < groups)
+    {
+        CPU_SET(cpus[group % number], &set);
+    }
+    else
+    {
+        for(int i = group * number / groups; i < (group + 1) * number / groups; ++i)
+        {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// one queue shared by all the producers and workers
+template<class E>
+class Shared_queue
+{
+public:
+    Shared_queue(int queue_number, int thread_number, int max_requests):
+        m_queue(max_requests) {}
+
+    bool push(const E& item, int hint) {return m_queue.push(item);}
+    bool pop(E& item, int worker) {return m_queue.pop(item);}
+    int capacity() const {return m_queue.capacity();}
+    int groups() const {return 1;}
+    int group(int worker) const {return 0;}
+
+private:
+    Mpmc_queue<E> m_queue;
+};
+
+/* one queue per producer. the workers are split into groups, one per queue, each
+ * pinned with its reactor to a slice of the cpus: a worker serves the queue of its own
+ * reactor first, so a request is normally processed by the same group of threads, on
+ * the same cpus, as its connection. a worker only steals from the queues of the other
+ * reactors once its own has stayed empty for STEAL_SPIN rounds */
+template<class E>
+class Stealing_queue
+{
+public:
+    Stealing_queue(int queue_number, int thread_number, int max_requests);
+    ~Stealing_queue();
+
+    bool push(const E& item, int hint);
+    bool pop(E& item, int worker);
+    int capacity() const {return m_capacity;}
+    int groups() const {return m_queues.size();}
+    int group(int worker) const {return worker % m_queues.size();}
+
+    static const int STEAL_SPIN = 64;
+
+private:
+    std::vector<Mpmc_queue<E>*> m_queues;
+    int m_capacity;
+
+private:
+    Stealing_queue(const Stealing_queue&) = delete;
+    Stealing_queue& operator = (const Stealing_queue&) = delete;
+};
+
+template<class E>
+Stealing_queue<E>::Stealing_queue(int queue_number, int thread_number, int max_requests)
+{
+    if(queue_number <= 0)
+    {
+        queue_number = 1;
+    }
+    // never more queues than workers, or some queue would have no home worker
+    if(queue_number > thread_number)
+    {
+        queue_number = thread_number;
+    }
+
+    // the bound of the pool is shared among the local queues
+    int per_queue = max_requests / queue_number;
+    m_capacity = 0;
+    for(int i = 0; i < queue_number; ++i)
+    {
+        m_queues.push_back(new Mpmc_queue<E>(per_queue > 0 ? per_queue : 1));
+        m_capacity += m_queues.back()->capacity();
+    }
+}
+
+template<class E>
+Stealing_queue<E>::~Stealing_queue()
+{
+    for(Mpmc_queue<E>* queue : m_queues)
+    {
+        delete queue;
+    }
+}
+
+template<class E>
+bool Stealing_queue<E>::push(const E& item, int hint)
+{
+    return m_queues[hint % m_queues.size()]->push(item);
+}
+
+template<class E>
+bool Stealing_queue<E>::pop(E& item, int worker)
+{
+    int number = m_queues.size();
+    int home = worker % number;
+    for(int spin = 0; spin < (number > 1 ? STEAL_SPIN : 1); ++spin)
+    {
+        if(m_queues[home]->pop(item))
+        {
+            return true;
+        }
+        cpu_relax();
+    }
+    for(int i = 1; i < number; ++i)
+    {
+        if(m_queues[(home + i) % number]->pop(item))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif